@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "cbor_common.h"
+
+//
+// A bump allocator for parsed trees.
+//
+// Memory is handed out from large chunks and is only ever released all at once: by `reset()`, which keeps the chunks
+// for the next parse (so a steady state of parse/reset does no allocation), or by destroying the arena.
+//
+// Destructors of objects placed in the arena are NOT run. That is fine for `Node`s built by the tree parser with an
+// arena, since they do not own anything themselves.
+//
+
+namespace cbor {
+
+	struct Arena {
+		static constexpr size_t kDefaultChunkSize = 1 << 16;
+		static constexpr size_t kMaxChunkSize     = 1 << 24;
+
+		inline explicit Arena(size_t chunkSize = kDefaultChunkSize) : nextChunkSize_(std::max<size_t>(chunkSize, 64)) {}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		Arena(Arena&&) = default;
+		Arena& operator=(Arena&&) = default;
+
+		inline void* allocate(size_t n, size_t align = alignof(std::max_align_t)) {
+			while (current_ < chunks_.size()) {
+				size_t at = (offset_ + align - 1) & ~(align - 1);
+				if (at + n <= chunks_[current_].size) {
+					offset_ = at + n;
+					used_ += n;
+					return chunks_[current_].data.get() + at;
+				}
+				// Left over chunks from before a `reset()` are reused in order.
+				current_++;
+				offset_ = 0;
+			}
+
+			size_t size = std::max(nextChunkSize_, n + align);
+			nextChunkSize_ = std::min(nextChunkSize_ * 2, kMaxChunkSize);
+			chunks_.push_back(Chunk { std::unique_ptr<byte[]>(new byte[size]), size });
+			capacity_ += size;
+			current_ = chunks_.size() - 1;
+			offset_ = 0;
+			return allocate(n, align);
+		}
+
+		// `n` default constructed `T`s.
+		template <class T>
+		inline T* make(size_t n) {
+			if (n == 0) return nullptr;
+			T* out = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+			for (size_t i=0; i<n; i++) new (out + i) T();
+			return out;
+		}
+
+		inline const byte* copy(const byte* data, size_t len) {
+			byte* out = static_cast<byte*>(allocate(len, 1));
+			memcpy(out, data, len);
+			return out;
+		}
+
+		// Forget everything allocated, keeping the chunks.
+		inline void reset() {
+			current_ = 0;
+			offset_ = 0;
+			used_ = 0;
+		}
+
+		inline size_t used() const { return used_; }
+		inline size_t capacity() const { return capacity_; }
+
+		private:
+
+		struct Chunk {
+			std::unique_ptr<byte[]> data;
+			size_t size;
+		};
+
+		std::vector<Chunk> chunks_;
+		size_t current_       = 0;
+		size_t offset_        = 0;
+		size_t used_          = 0;
+		size_t capacity_      = 0;
+		size_t nextChunkSize_ = kDefaultChunkSize;
+	};
+
+}
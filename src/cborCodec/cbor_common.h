@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cassert>
 #include <limits>
+#include <memory>
 #include <string_view>
 #include <type_traits>
 #include <vector>
@@ -26,6 +27,101 @@ namespace cbor {
     struct False { };
     struct Null { };
 
+	//
+	// Everything about an item that can be known from its initial byte, in a 256-entry table.
+	//
+	// `argWidth` is how many bytes of argument follow the initial byte (0, 1, 2, 4 or 8). When it is zero, the argument is the
+	// additional info itself (or there is none, for indefinite lengths and the break byte).
+	//
+	enum class HeadClass : uint8_t {
+		Unsigned, Negative, Bytes, Text, Array, Map, Tag,
+		False, True, Null, Simple, Float16, Float32, Float64, Break,
+		Reserved, // additional info 28..30, and things this codec does not support (indefinite strings, undefined)
+	};
+
+	struct InitialByte {
+		uint8_t majorType;
+		uint8_t argWidth;
+		HeadClass cls;
+		bool indefinite;
+	};
+
+	namespace {
+		constexpr uint8_t kArgWidthForInfo[4] = { 1, 2, 4, 8 }; // additional info 24..27
+
+		constexpr InitialByte makeInitialByte(uint8_t b) {
+			uint8_t m  = b >> 5;
+			uint8_t ai = b & 0b11111;
+			uint8_t w  = (ai >= 24 and ai <= 27) ? kArgWidthForInfo[ai - 24] : 0;
+
+			if (ai >= 28 and ai <= 30) return InitialByte { m, 0, HeadClass::Reserved, false };
+
+			if (m == 7) {
+				if (ai == 20) return InitialByte { m, 0, HeadClass::False, false };
+				if (ai == 21) return InitialByte { m, 0, HeadClass::True, false };
+				if (ai == 22) return InitialByte { m, 0, HeadClass::Null, false };
+				if (ai < 24) return InitialByte { m, 0, HeadClass::Simple, false };
+				if (ai == 24) return InitialByte { m, 1, HeadClass::Simple, false };
+				if (ai == 25) return InitialByte { m, 2, HeadClass::Float16, false };
+				if (ai == 26) return InitialByte { m, 4, HeadClass::Float32, false };
+				if (ai == 27) return InitialByte { m, 8, HeadClass::Float64, false };
+				return InitialByte { m, 0, HeadClass::Break, false };
+			}
+
+			constexpr HeadClass classes[7] = {
+				HeadClass::Unsigned, HeadClass::Negative, HeadClass::Bytes, HeadClass::Text,
+				HeadClass::Array, HeadClass::Map, HeadClass::Tag };
+			bool indefinite = ai == 31;
+			if (indefinite and (m == 0 or m == 1 or m == 6)) return InitialByte { m, 0, HeadClass::Reserved, false };
+			if (indefinite and (m == 2 or m == 3)) return InitialByte { m, 0, HeadClass::Reserved, true };
+			return InitialByte { m, w, classes[m], indefinite };
+		}
+
+		constexpr std::array<InitialByte, 256> makeInitialByteTable() {
+			std::array<InitialByte, 256> t {};
+			for (int i = 0; i < 256; i++) t[i] = makeInitialByte(static_cast<uint8_t>(i));
+			return t;
+		}
+	}
+
+	constexpr std::array<InitialByte, 256> kInitialByteTable = makeInitialByteTable();
+
+	//
+	// The reverse direction, for encoders: the smallest argument encoding for `v` (for v >= 24).
+	// Indexed by the number of significant bytes of `v`.
+	//
+	constexpr uint8_t kArgWidthForBytes[9] = { 1, 1, 2, 4, 4, 8, 8, 8, 8 };
+	constexpr uint8_t kArgInfoForBytes[9]  = { 24, 24, 25, 26, 26, 27, 27, 27, 27 };
+
+	inline uint8_t significantBytes(uint64_t v) {
+		return v == 0 ? 0 : static_cast<uint8_t>((71 - __builtin_clzll(v)) >> 3);
+	}
+
+	// Writes the initial byte and argument for `(majorType, v)` into `out` (at most 9 bytes), returning the count.
+	inline size_t encodeHead(uint8_t* out, uint8_t majorType, uint64_t v) {
+		uint8_t m = majorType << 5;
+		if (v < 24) {
+			out[0] = m | static_cast<uint8_t>(v);
+			return 1;
+		}
+		uint8_t n = significantBytes(v);
+		uint8_t w = kArgWidthForBytes[n];
+		out[0] = m | kArgInfoForBytes[n];
+		uint64_t be = __builtin_bswap64(v); // NOTE: Assumes a little-endian host, like the rest of the codec.
+		memcpy(out + 1, reinterpret_cast<const uint8_t*>(&be) + 8 - w, w);
+		return 1 + w;
+	}
+
+	// Big-endian argument of width 1, 2, 4 or 8 from an unaligned pointer.
+	inline uint64_t loadArgument(const uint8_t* p, uint8_t width) {
+		switch (width) {
+			case 1: return p[0];
+			case 2: { uint16_t v; memcpy(&v, p, 2); return __builtin_bswap16(v); }
+			case 4: { uint32_t v; memcpy(&v, p, 4); return __builtin_bswap32(v); }
+			default: { uint64_t v; memcpy(&v, p, 8); return __builtin_bswap64(v); }
+		}
+	}
+
     namespace {
         template <class T> T maybeSwapBytes(bool littleEndian, const T& v) {
             return v;
@@ -48,18 +144,25 @@ namespace cbor {
 	//
 	// Note that those classes subclass this one which makes std::variant<> easy to use while not duplicating code.
 	//
+	// The parser itself now hands out trivially-copyable `Item` tokens, so these are only materialized on request
+	// (`Item::expect<TextBuffer>()` etc.) and by the tree parser, which is where owning copies are made.
+	//
+	// A view may also share ownership of the memory it points into through `owner` (e.g. the input slab of a
+	// `BinStreamShared`), which makes it safe to keep after the input would otherwise be gone, without copying.
+	//
 	struct DataBuffer {
 		// std::vector<uint8_t> buf;
 		const byte* buf = 0;
 		std::size_t len = 0;
 		bool isView = true;
+		std::shared_ptr<const void> owner; // Optional: keeps the memory of a view alive
 
 		inline DataBuffer() {}
 
 		DataBuffer(const DataBuffer& o) = delete;
 		DataBuffer operator=(const DataBuffer& o) = delete;
 
-		inline DataBuffer(DataBuffer&& o) : buf(o.buf), len(o.len), isView(o.isView) {
+		inline DataBuffer(DataBuffer&& o) : buf(o.buf), len(o.len), isView(o.isView), owner(std::move(o.owner)) {
 			o.isView = false;
 			o.buf = nullptr;
 			o.len = 0;
@@ -69,6 +172,7 @@ namespace cbor {
 			isView = o.isView;
 			buf = o.buf;
 			len = o.len;
+			owner = std::move(o.owner);
 			o.isView = false;
 			o.buf = nullptr;
 			o.len = 0;
@@ -90,6 +194,7 @@ namespace cbor {
 			}
 			buf = 0;
 			len = 0;
+			owner.reset();
 		}
 
 		inline ~DataBuffer() {
@@ -287,17 +392,11 @@ namespace cbor {
     // FIXME: MISLEADING NAME: this hton should be conditional -- this swaps unconditionally (assumes WE are little endian)
 
     inline uint64_t htonll(uint64_t v) {
-        uint64_t o = 0;
-// #pragma unroll
-        for (int i = 0; i < 8; i++) { o |= ((v >> static_cast<uint64_t>(8 * (8 - i - 1))) & 0b1111'1111) << (8 * i); }
-        return o;
+        return __builtin_bswap64(v);
     }
 
     inline uint64_t ntohll(uint64_t v) {
-        uint64_t o = 0;
-// #pragma unroll
-        for (int i = 0; i < 8; i++) { o |= ((v >> static_cast<uint64_t>(8 * (8 - i - 1))) & 0b1111'1111) << (8 * i); }
-        return o;
+        return __builtin_bswap64(v);
     }
 
     inline uint16_t ntoh(const uint16_t& v) {
@@ -1,17 +1,25 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <deque>
 #include <fstream>
 #include <limits>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <type_traits>
+#include <variant>
 #include <vector>
 
 #include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
 #include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "cbor_common.h"
 
@@ -21,6 +29,9 @@
 // This thing maintains no state and thus has no debugging assertions or error handling or anything like that.
 // It's all up to the user to use properly!
 //
+// The output goes to a sink given as a template parameter (`CborBufferEncoder`, `CborFileEncoder`). `CborEncoder`
+// erases the sink type, for `encodeCbor` hooks that take a concrete encoder type.
+//
 // FIXME: THIS ASSUMES THAT THE HOST IS LITTLE-ENDIAN.
 //
 // WARNING: Beware the implicit casts.
@@ -34,42 +45,54 @@ namespace cbor {
 
 
 	struct OutBinStreamBuffer {
+		static constexpr size_t kDefaultCapacity = 1 << 10;
+
 		std::vector<uint8_t> data;
 		size_t cursor = kInvalidCursor;
 
-		inline OutBinStreamBuffer() {
-			cursor = kInvalidCursor;
-		}
+		inline OutBinStreamBuffer() : OutBinStreamBuffer(kDefaultCapacity) {}
 		inline OutBinStreamBuffer(size_t size) {
-			data.resize(size);
+			data.resize(std::max<size_t>(size, 1));
 			cursor = 0;
 		}
 
 		inline void write(const uint8_t* bytes, size_t len) {
-			// if (cursor + len >= data.size()) data.resize(data.size() * 2);
-			if (cursor + len >= data.size()) {
-				if (data.size() * 2 >= cursor + len)
-					data.resize(data.size() * 2);
-				else {
-					size_t targetSize = data.size() * 2;
-					while (cursor + len >= targetSize) {
-						targetSize *= 2;
-					}
-					data.resize(targetSize);
-				}
-			}
-
+			if (cursor + len >= data.size()) grow(len);
 			memcpy(data.data() + cursor, bytes, len);
 			cursor += len;
 		}
 
+		// A head and its payload, with one capacity check.
+		inline void write(const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+			if (cursor + headLen + len >= data.size()) grow(headLen + len);
+			memcpy(data.data() + cursor, head, headLen);
+			memcpy(data.data() + cursor + headLen, bytes, len);
+			cursor += headLen + len;
+		}
+
+		// Hands out the encoded bytes. Further writes start a new, empty buffer.
 		inline std::vector<uint8_t> finish() {
             if (cursor != kInvalidCursor) data.resize(cursor);
-			// return std::move(data);
-			return data;
+			cursor = 0;
+			return std::move(data);
 		}
 
 		inline bool valid() const { return cursor != kInvalidCursor; }
+
+		// For back-patching (see `BasicCborEncoder::set_patch_indefinite`).
+		inline size_t size() const { return cursor; }
+		inline uint8_t* patch(size_t pos, size_t len) { return data.data() + pos; }
+
+		private:
+
+		// Kept out of line, so that `write` inlines to a compare and a copy.
+		__attribute__((noinline)) void grow(size_t len) {
+			size_t targetSize = std::max<size_t>(data.size() * 2, kDefaultCapacity);
+			while (cursor + len >= targetSize) {
+				targetSize *= 2;
+			}
+			data.resize(targetSize);
+		}
 	};
 
 
@@ -94,27 +117,411 @@ namespace cbor {
 		inline bool valid() const { return ofs.good(); }
 	};
 
-	struct CborEncoder {
+
+	//
+	// A growable buffer for encoding many messages in a row.
+	//
+	// Unlike `OutBinStreamBuffer`, growing does not zero-fill, `reset()` keeps the capacity, and the result is handed out
+	// as a view (`view()` / `finish()`, valid until the next write or reset) or by move (`release()`). Once it has grown
+	// to fit the largest message, encoding does no allocation.
+	//
+	struct OutBinStreamGrowable {
+
+		inline OutBinStreamGrowable(size_t capacity = OutBinStreamBuffer::kDefaultCapacity)
+			: data_(new uint8_t[std::max<size_t>(capacity, 1)]), capacity_(std::max<size_t>(capacity, 1)) {}
+
+		inline void write(const uint8_t* bytes, size_t len) {
+			if (cursor_ + len > capacity_) grow(len);
+			memcpy(data_.get() + cursor_, bytes, len);
+			cursor_ += len;
+		}
+
+		inline void write(const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+			if (cursor_ + headLen + len > capacity_) grow(headLen + len);
+			memcpy(data_.get() + cursor_, head, headLen);
+			memcpy(data_.get() + cursor_ + headLen, bytes, len);
+			cursor_ += headLen + len;
+		}
+
+		inline ByteBuffer view() const { return ByteBuffer(data_.get(), cursor_); }
+		inline ByteBuffer finish() { return view(); }
+
+		// Hands out the encoded bytes as an owning buffer. The next write allocates anew.
+		inline ByteBuffer release() {
+			ByteBuffer out(data_.release(), cursor_);
+			out.isView = false;
+			capacity_ = 0;
+			cursor_ = 0;
+			return out;
+		}
+
+		// Forget the encoded bytes, keeping the capacity.
+		inline void reset() { cursor_ = 0; }
+
+		inline size_t size() const { return cursor_; }
+		inline size_t capacity() const { return capacity_; }
+
+		inline uint8_t* patch(size_t pos, size_t len) { return data_.get() + pos; }
+
+		private:
+
+		__attribute__((noinline)) void grow(size_t len) {
+			size_t targetSize = std::max<size_t>(capacity_ * 2, OutBinStreamBuffer::kDefaultCapacity);
+			while (cursor_ + len > targetSize) {
+				targetSize *= 2;
+			}
+			std::unique_ptr<uint8_t[]> grown(new uint8_t[targetSize]);
+			if (cursor_) memcpy(grown.get(), data_.get(), cursor_);
+			data_ = std::move(grown);
+			capacity_ = targetSize;
+		}
+
+		std::unique_ptr<uint8_t[]> data_;
+		size_t capacity_ = 0;
+		size_t cursor_   = 0;
+	};
+
+
+	//
+	// Encodes into a caller-provided buffer of fixed capacity, which is never grown.
+	//
+	// Writes that do not fit are dropped and set `overflowed()`, but `size()` keeps counting, so after an overflow it is
+	// the capacity that would have been needed. `finish()` throws on overflow, and otherwise returns the encoded size.
+	//
+	struct OutBinStreamSpan {
+
+		inline OutBinStreamSpan(uint8_t* data, size_t capacity) : data_(data), capacity_(capacity) {}
+
+		inline void write(const uint8_t* bytes, size_t len) {
+			if (cursor_ + len <= capacity_) memcpy(data_ + cursor_, bytes, len);
+			cursor_ += len;
+		}
+
+		inline void write(const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+			if (cursor_ + headLen + len <= capacity_) {
+				memcpy(data_ + cursor_, head, headLen);
+				memcpy(data_ + cursor_ + headLen, bytes, len);
+			}
+			cursor_ += headLen + len;
+		}
+
+		inline bool overflowed() const { return cursor_ > capacity_; }
+
+		inline ByteBuffer view() const {
+			assert(!overflowed());
+			return ByteBuffer(data_, cursor_);
+		}
+
+		inline size_t finish() {
+			if (overflowed()) throw std::runtime_error("cbor: encoded output needs " + std::to_string(cursor_) + " bytes, but the buffer holds " + std::to_string(capacity_) + ".");
+			return cursor_;
+		}
+
+		inline void reset() { cursor_ = 0; }
+
+		inline size_t size() const { return cursor_; }
+		inline size_t capacity() const { return capacity_; }
+
+		// Nothing past the capacity was written, so there is nothing to patch there.
+		inline uint8_t* patch(size_t pos, size_t len) { return pos + len <= capacity_ ? data_ + pos : nullptr; }
+
+		private:
+		uint8_t* data_;
+		size_t capacity_;
+		size_t cursor_ = 0;
+	};
+
+
+	//
+	// Counts bytes instead of writing them, for `CborSizer`.
+	//
+	struct OutBinStreamCounter {
+		inline void write(const uint8_t*, size_t len) { size_ += len; }
+		inline void write(const uint8_t*, size_t headLen, const uint8_t*, size_t len) { size_ += headLen + len; }
+
+		inline size_t finish() { return size_; }
+		inline void reset() { size_ = 0; }
+		inline size_t size() const { return size_; }
+		inline uint8_t* patch(size_t, size_t) { return nullptr; }
+
 		private:
+		size_t size_ = 0;
+	};
+
+
+	//
+	// Keeps large payloads by reference instead of copying them, for writing out with `writev`.
+	//
+	// Heads and small values are copied into an internal buffer as usual, but string, byte string and typed array
+	// payloads of at least `minReference` bytes are recorded as references to the caller's memory. The output is a list of
+	// `iovec`s alternating between the two: flush it with `writeTo(fd)` / `pwriteTo(fd, offset)`, or take it from
+	// `iovecs()` to hand to something else. Referenced payloads must stay alive and unchanged until then.
+	//
+	// Heads cannot be back-patched (see `BasicCborEncoder::set_patch_indefinite`).
+	//
+	struct OutBinStreamScatter {
+		static constexpr size_t kDefaultMinReference = 4096;
 
-		// Only one will be active.
-		// NOTE: This used to be templated, but it's simpler to support custom type encoders
-		//       by having it non-templated.
-		OutBinStreamBuffer strm1;
-		OutBinStreamFile strm2;
+		inline OutBinStreamScatter(size_t minReference = kDefaultMinReference) : minReference_(minReference) {}
+
+		inline void write(const uint8_t* bytes, size_t len) {
+			if (len == 0) return;
+			if (segments_.empty() or segments_.back().ref) segments_.push_back(Segment { nullptr, inline_.size(), 0 });
+			inline_.insert(inline_.end(), bytes, bytes + len);
+			segments_.back().len += len;
+			size_ += len;
+		}
 
-		public:
+		inline void write(const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+			write(head, headLen);
+			if (len < minReference_) {
+				write(bytes, len);
+				return;
+			}
+			segments_.push_back(Segment { bytes, 0, len });
+			size_ += len;
+		}
 
-		inline CborEncoder(std::ofstream&& ofs) : strm2(std::move(ofs)) {}
-		inline CborEncoder(const std::string& path) : strm2(path) {}
-		inline CborEncoder() : strm1(1<<10) {}
+		// The output so far, valid until the next write or reset.
+		inline const std::vector<iovec>& iovecs() {
+			iov_.clear();
+			for (const Segment& s : segments_) {
+				const uint8_t* base = s.ref ? s.ref : inline_.data() + s.offset;
+				iov_.push_back(iovec { const_cast<uint8_t*>(base), s.len });
+			}
+			return iov_;
+		}
+
+		inline const std::vector<iovec>& finish() { return iovecs(); }
+
+		// Write everything to `fd`, at its current position or at `offset`. Returns the bytes written, throws on errors.
+		inline size_t writeTo(int fd) {
+			return flush([fd](const iovec* iov, int n, size_t) { return ::writev(fd, iov, n); });
+		}
+		inline size_t pwriteTo(int fd, off_t offset) {
+			return flush([fd, offset](const iovec* iov, int n, size_t done) { return ::pwritev(fd, iov, n, offset + done); });
+		}
+
+		// Forget the output, keeping the capacity.
+		inline void reset() {
+			inline_.clear();
+			segments_.clear();
+			size_ = 0;
+		}
+
+		inline size_t size() const { return size_; }
+
+		private:
 
+		struct Segment {
+			const uint8_t* ref; // A referenced payload, or nullptr for bytes of `inline_`
+			size_t offset;      // Inline: where the bytes start in `inline_`
+			size_t len;
+		};
+
+		template <class Write>
+		inline size_t flush(Write&& write) {
+			iovecs();
+			size_t i = 0, done = 0;
+			while (true) {
+				while (i < iov_.size() and iov_[i].iov_len == 0) i++;
+				if (i == iov_.size()) return done;
+
+				ssize_t n = write(iov_.data() + i, static_cast<int>(std::min<size_t>(iov_.size() - i, IOV_MAX)), done);
+				if (n < 0) {
+					if (errno == EINTR) continue;
+					throw std::runtime_error(std::string("cbor: writing encoded output failed: ") + strerror(errno));
+				}
+				done += n;
+
+				// Skip over what was written, which may end partway through an iovec.
+				size_t w = n;
+				while (w > 0) {
+					size_t step = std::min(w, iov_[i].iov_len);
+					iov_[i].iov_base = static_cast<uint8_t*>(iov_[i].iov_base) + step;
+					iov_[i].iov_len -= step;
+					w -= step;
+					if (iov_[i].iov_len == 0) i++;
+				}
+			}
+		}
+
+		size_t minReference_;
+		std::vector<uint8_t> inline_;
+		std::vector<Segment> segments_;
+		std::vector<iovec> iov_;
+		size_t size_ = 0;
+	};
+
+
+	namespace {
+		template <class Sink, class = void>
+		struct HasSplitWrite : std::false_type {};
+		template <class Sink>
+		struct HasSplitWrite<Sink, std::void_t<decltype(std::declval<Sink&>().write((const uint8_t*)nullptr, size_t{}, (const uint8_t*)nullptr, size_t{}))>> : std::true_type {};
+
+		template <class Sink, class = void>
+		struct HasPatch : std::false_type {};
+		template <class Sink>
+		struct HasPatch<Sink, std::void_t<decltype(std::declval<Sink&>().patch(size_t{}, size_t{}))>> : std::true_type {};
+	}
+
+
+	//
+	// The sink behind `CborEncoder`: either an owned buffer or file, or a reference to the sink of another encoder.
+	// Every write is one indirect call, so only use it where a concrete encoder type is needed (see `CborEncoder`).
+	//
+	struct AnySink {
+
+		inline AnySink() : owned_(std::in_place_type<OutBinStreamBuffer>) { bind(std::get<OutBinStreamBuffer>(owned_)); }
+		inline AnySink(const std::string& path) : owned_(std::in_place_type<OutBinStreamFile>, path) { bind(std::get<OutBinStreamFile>(owned_)); }
+		inline AnySink(std::ofstream&& ofs) : owned_(std::in_place_type<OutBinStreamFile>, std::move(ofs)) { bind(std::get<OutBinStreamFile>(owned_)); }
+
+		// Forward to `sink`, which must outlive this.
+		template <class S, typename = decltype(std::declval<S&>().write((const uint8_t*)nullptr, size_t{}))>
+		inline AnySink(S& sink) { bind(sink); }
+
+		// `target_` may point into `owned_`, so a move re-binds to the moved sink (and a forwarding one keeps forwarding).
+		AnySink(const AnySink&) = delete;
+		AnySink& operator=(const AnySink&) = delete;
+
+		inline AnySink(AnySink&& o) : owned_(std::move(o.owned_)), target_(o.target_), write_(o.write_), writeSplit_(o.writeSplit_), size_(o.size_), patch_(o.patch_) {
+			if (auto b = std::get_if<OutBinStreamBuffer>(&owned_)) bind(*b);
+			else if (auto f = std::get_if<OutBinStreamFile>(&owned_)) bind(*f);
+		}
+
+		inline void write(const uint8_t* bytes, size_t len) {
+			write_(target_, bytes, len);
+		}
+
+		// A head and its payload, so that a scatter sink can still reference the payload.
+		inline void write(const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+			writeSplit_(target_, head, headLen, bytes, len);
+		}
+
+		// For back-patching, when the sink supports it (the owned buffer does, files do not).
+		inline bool canPatch() const { return patch_ != nullptr; }
+		inline size_t size() const { return size_ ? size_(target_) : 0; }
+		inline uint8_t* patch(size_t pos, size_t len) { return patch_ ? patch_(target_, pos, len) : nullptr; }
+
+		// The encoded bytes of an owned buffer. Otherwise empty (files are flushed).
 		inline std::vector<uint8_t> finish() {
-			if (strm1.valid()) return strm1.finish();
-			else strm2.finish();
+			if (auto b = std::get_if<OutBinStreamBuffer>(&owned_)) return b->finish();
+			if (auto f = std::get_if<OutBinStreamFile>(&owned_)) f->finish();
 			return {};
 		}
 
+		private:
+
+		template <class S>
+		inline void bind(S& sink) {
+			target_ = &sink;
+			write_  = [](void* s, const uint8_t* bytes, size_t len) { static_cast<S*>(s)->write(bytes, len); };
+			writeSplit_ = [](void* s, const uint8_t* head, size_t headLen, const uint8_t* bytes, size_t len) {
+				if constexpr (HasSplitWrite<S>::value) {
+					static_cast<S*>(s)->write(head, headLen, bytes, len);
+				} else {
+					static_cast<S*>(s)->write(head, headLen);
+					static_cast<S*>(s)->write(bytes, len);
+				}
+			};
+			size_   = nullptr;
+			patch_  = nullptr;
+			if constexpr (HasPatch<S>::value) {
+				size_  = [](void* s) { return static_cast<S*>(s)->size(); };
+				patch_ = [](void* s, size_t pos, size_t len) { return static_cast<S*>(s)->patch(pos, len); };
+			}
+		}
+
+		std::variant<std::monostate, OutBinStreamBuffer, OutBinStreamFile> owned_;
+		void* target_;
+		void (*write_)(void*, const uint8_t*, size_t);
+		void (*writeSplit_)(void*, const uint8_t*, size_t, const uint8_t*, size_t);
+		size_t (*size_)(void*);
+		uint8_t* (*patch_)(void*, size_t, size_t);
+	};
+
+
+	template <class Sink> struct BasicCborEncoder;
+
+	//
+	// The encoder type that `encodeCbor(CborEncoder&)` hooks take, and a general purpose encoder on its own: to a growable
+	// buffer by default, or to a file when given a path or stream. Prefer `CborBufferEncoder` and `CborFileEncoder` on
+	// hot paths, whose writes are resolved at compile time.
+	//
+	using CborEncoder       = BasicCborEncoder<AnySink>;
+	using CborBufferEncoder = BasicCborEncoder<OutBinStreamBuffer>;
+	using CborFileEncoder   = BasicCborEncoder<OutBinStreamFile>;
+
+	// For steady-state encoding without allocation: into a reused buffer, or into a caller-provided one.
+	using CborGrowableEncoder = BasicCborEncoder<OutBinStreamGrowable>;
+	using CborSpanEncoder     = BasicCborEncoder<OutBinStreamSpan>;
+
+	// Large payloads by reference, for `writev` (see `OutBinStreamScatter`).
+	using CborScatterEncoder = BasicCborEncoder<OutBinStreamScatter>;
+
+	//
+	// Takes the same calls as an encoder (including `encodeCbor` hooks and `encodeTree`), and `finish()` returns the exact
+	// encoded size without writing anything: size a `CborSpanEncoder` or `OutBinStreamGrowable` once, then encode.
+	//
+	using CborSizer = BasicCborEncoder<OutBinStreamCounter>;
+
+	namespace {
+		template <class T, class Encoder, class = void>
+		struct HasEncodeCbor : std::false_type {};
+		template <class T, class Encoder>
+		struct HasEncodeCbor<T, Encoder, std::void_t<decltype(std::declval<const T&>().encodeCbor(std::declval<Encoder&>()))>> : std::true_type {};
+	}
+
+	//
+	// The encoder, for any sink with `write(const uint8_t*, size_t)`.
+	//
+	// Each value is assembled on the stack and handed to the sink in one `write`, so with a buffer sink it compiles to a
+	// capacity check and a copy. Sinks may also provide `write(head, headLen, bytes, len)` for strings, to check once.
+	//
+	template <class Sink>
+	struct BasicCborEncoder {
+		Sink strm;
+
+		inline BasicCborEncoder() {}
+
+		// Construct the sink from `arg` (e.g. a path or a stream for a file, or another sink to forward to).
+		template <class A, typename = std::enable_if_t<std::is_constructible_v<Sink, A&&> and !std::is_same_v<std::decay_t<A>, BasicCborEncoder>>>
+		inline BasicCborEncoder(A&& arg) : strm(std::forward<A>(arg)) {}
+
+		// e.g. the buffer and capacity of a span.
+		template <class A, class B>
+		inline BasicCborEncoder(A&& a, B&& b) : strm(std::forward<A>(a), std::forward<B>(b)) {}
+
+		inline auto finish() {
+			return strm.finish();
+		}
+
+		// Start over, for sinks that can (`OutBinStreamGrowable`, `OutBinStreamSpan`).
+		inline void reset() {
+			strm.reset();
+			open_.clear();
+		}
+
+		//
+		// Write containers begun with `kIndefiniteLength` as definite-length ones, so decoders know their size up front.
+		//
+		// Their head is written with room for a count below 256, and patched when `end_indefinite` closes them. Larger
+		// counts shift the container's contents to widen the head. Heads are thus not always minimal (a count below 24
+		// takes two bytes), which is still valid CBOR. Only for sinks that can be written to in place (the buffer sinks,
+		// and `CborSizer`, which sizes the patched output). For `CborEncoder`, that is checked when enabling, and throws.
+		//
+		// Containers begun before enabling are ended with a break byte as usual.
+		//
+		inline void set_patch_indefinite(bool enable = true) {
+			static_assert(HasPatch<Sink>::value, "this sink does not support back-patching");
+			if constexpr (std::is_same_v<Sink, AnySink>) {
+				if (enable and !strm.canPatch()) throw std::runtime_error("cbor: this encoder's sink does not support back-patching.");
+			}
+			assert(open_.empty());
+			patchIndefinite_ = enable;
+		}
+
 		template <class K, class V>
 		inline void push_key_value(const K& k, const V& v) {
 			push_value(k);
@@ -158,10 +565,22 @@ namespace cbor {
 		inline void push_value(Bool) {
 			assert(false && "Do not use push_value(bool). Use push_value(True) or push_value(False).");
 		}
-		
-		template <typename T, typename V=std::enable_if_t<std::is_member_function_pointer_v<decltype(&T::encodeCbor)>>>
+
+		// Types with an `encodeCbor` member. Hooks that take this encoder type (e.g. templated ones) are called with it,
+		// and hooks that take `CborEncoder&` get one that forwards to this encoder's sink, and patches indefinite
+		// containers if this encoder does. A hook must encode exactly one value.
+		template <typename T, typename V=std::enable_if_t<HasEncodeCbor<T, BasicCborEncoder>::value or HasEncodeCbor<T, CborEncoder>::value>>
 		inline void push_value(const T& t) {
-			t.encodeCbor(*this);
+			if constexpr (HasEncodeCbor<T, BasicCborEncoder>::value) {
+				t.encodeCbor(*this);
+			} else {
+				counted();
+				CborEncoder facade(strm);
+				if constexpr (HasPatch<Sink>::value) {
+					if (patchIndefinite_) facade.set_patch_indefinite();
+				}
+				t.encodeCbor(facade);
+			}
 		}
 
 		// private:
@@ -173,119 +592,232 @@ namespace cbor {
 		template <class T>
 		inline void write(const T& t) {
 			static_assert(std::is_fundamental<T>::value, "bad write<T> call -- only primitives allowed.");
-			if (strm1.valid()) strm1.write((const uint8_t*)&t, sizeof(T));
-			else strm2.write((const uint8_t*)&t, sizeof(T));
+			strm.write((const uint8_t*)&t, sizeof(T));
 		}
 		inline void write(const uint8_t* d, size_t len) {
-			if (strm1.valid()) strm1.write(d, len);
-			else strm2.write(d, len);
+			strm.write(d, len);
+		}
+
+		// A string's head and payload.
+		inline void write_string(byte majorType, const uint8_t* d, size_t len) {
+			byte head[9];
+			size_t n = encodeHead(head, majorType, len);
+			if constexpr (HasSplitWrite<Sink>::value) {
+				strm.write(head, n, d, len);
+			} else {
+				strm.write(head, n);
+				strm.write(d, len);
+			}
+		}
+
+		private:
+
+		//
+		// Back-patching state. Containers are only tracked while a patched one is open, since only then do values need
+		// counting: patched containers count their items up, definite ones inside them count down to know when they end.
+		//
+		struct OpenContainer {
+			size_t head;  // Patched: sink position of the head
+			size_t items; // Patched: items so far (keys and values both count). Definite: items left
+			bool patched;
+			bool map;
+		};
+		std::vector<OpenContainer> open_;
+		bool patchIndefinite_ = false;
+
+		// Count a value in the innermost tracked container.
+		inline void counted() {
+			if (!open_.empty()) countSlow();
 		}
 
+		void countSlow();
+		void begin_container(byte majorType, size_t size);
+		void end_patched();
+
 	};
 
-	inline void CborEncoder::push_value(uint8_t v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(uint8_t v) {
+		counted();
 		push_pos_integer(0b000, v);
 	}
-	inline void CborEncoder::push_value(int64_t v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(int64_t v) {
+		counted();
 		if (v >= 0)
 			push_pos_integer(0b000, v);
 		else
 			push_neg_integer(0b001, v);
 	}
-	inline void CborEncoder::push_value(uint64_t v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(uint64_t v) {
+		counted();
 		push_pos_integer(0b000, v);
 	}
 
 	// This ought to be two functions (one for lengths, one for normal integers...)
-	inline void CborEncoder::push_pos_integer(byte majorType, uint64_t v) {
-
-		byte m = majorType << 5;
+	// The head is assembled with `encodeHead` (the same width table the parser decodes with) and written at once.
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_pos_integer(byte majorType, uint64_t v) {
 
 		if (majorType != 0 and majorType != 1 and v == kIndefiniteLength) {
 			write(static_cast<byte>((majorType << 5) | 0b11111));
+			return;
 		}
 
-		else if (v < 24) {
-			write(static_cast<byte>(m | static_cast<uint8_t>(v)));
-		} else if (v < (1lu << 8lu)) {
-			write(static_cast<byte>(m | static_cast<uint8_t>(24)));
-			write((static_cast<uint8_t>(v)));
-		} else if (v < (1lu << 16lu)) {
-			write(static_cast<byte>(m | static_cast<uint8_t>(25)));
-			write(htons(static_cast<uint16_t>(v)));
-		} else if (v < (1lu << 32lu)) {
-			write(static_cast<byte>(m | static_cast<uint8_t>(26)));
-			write(htonl(static_cast<uint32_t>(v)));
-		} else {
-			write(static_cast<byte>(m | static_cast<uint8_t>(27)));
-			write(htonll(static_cast<uint64_t>(v)));
-		}
+		byte head[9];
+		write(head, encodeHead(head, majorType, v));
 	}
 
 	// I think...
-	inline void CborEncoder::push_neg_integer(byte majorType, int64_t v0) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_neg_integer(byte majorType, int64_t v0) {
 		uint64_t v = -v0 - 1;
 		push_pos_integer(majorType, v);
 	}
 
-	inline void CborEncoder::push_value(False v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(False v) {
+		counted();
 		write(static_cast<byte>((0b111 << 5) | 20));
 	}
-	inline void CborEncoder::push_value(True v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(True v) {
+		counted();
 		write(static_cast<byte>((0b111 << 5) | 21));
 	}
-	inline void CborEncoder::push_value(Null v) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(Null v) {
+		counted();
 		write(static_cast<byte>((0b111 << 5) | 22));
 	}
 
-	inline void CborEncoder::push_value(float v) {
-		write(static_cast<byte>((0b111 << 5) | 26));
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(float v) {
+		counted();
+		byte out[5] = { static_cast<byte>((0b111 << 5) | 26) };
 		v = hton(v);
-		write(v);
+		memcpy(out + 1, &v, sizeof(v));
+		write(out, sizeof(out));
 	}
-	inline void CborEncoder::push_value(double v) {
-		write(static_cast<byte>((0b111 << 5) | 27));
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(double v) {
+		counted();
+		byte out[9] = { static_cast<byte>((0b111 << 5) | 27) };
 		v = hton(v);
-		write(v);
+		memcpy(out + 1, &v, sizeof(v));
+		write(out, sizeof(out));
 	}
 
-	inline void CborEncoder::begin_array(size_t size) {
-		push_pos_integer(0b100, size);
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::begin_array(size_t size) {
+		if (!patchIndefinite_ and open_.empty()) push_pos_integer(0b100, size);
+		else begin_container(0b100, size);
+	}
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::begin_map(size_t size) {
+		if (!patchIndefinite_ and open_.empty()) push_pos_integer(0b101, size);
+		else begin_container(0b101, size);
+	}
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::end_indefinite() {
+		if (patchIndefinite_ and !open_.empty() and open_.back().patched) end_patched();
+		else write(byte{0b111'11111});
 	}
-	inline void CborEncoder::begin_map(size_t size) {
-		push_pos_integer(0b101, size);
+
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::countSlow() {
+		OpenContainer& c = open_.back();
+		if (c.patched) {
+			c.items++;
+			return;
+		}
+		// A container is counted in its parent when it begins, so a definite container is done with at its last item,
+		// even if that is a container still being written.
+		if (--c.items == 0) open_.pop_back();
 	}
-	inline void CborEncoder::end_indefinite() {
-		write(byte{0b111'11111});
+
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::begin_container(byte majorType, size_t size) {
+		counted();
+		bool map = majorType == 0b101;
+		if (size == kIndefiniteLength and patchIndefinite_) {
+			if constexpr (HasPatch<Sink>::value) {
+				open_.push_back(OpenContainer { strm.size(), 0, true, map });
+				byte head[2] = { static_cast<byte>((majorType << 5) | 24), 0 };
+				write(head, 2);
+			}
+			return;
+		}
+
+		push_pos_integer(majorType, size);
+		if (open_.empty()) return;
+		if (size == kIndefiniteLength) assert(false && "indefinite containers are patched while patching is enabled");
+		else if (size > 0) open_.push_back(OpenContainer { 0, map ? 2 * size : size, false, map });
+	}
+
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::end_patched() {
+		if constexpr (HasPatch<Sink>::value) {
+			assert(!open_.empty() and open_.back().patched && "end_indefinite() without an open indefinite container");
+			OpenContainer c = open_.back();
+			open_.pop_back();
+
+			assert(!c.map or c.items % 2 == 0);
+			uint64_t count = c.map ? c.items / 2 : c.items;
+			byte majorType = c.map ? 0b101 : 0b100;
+
+			if (count < 256) {
+				if (uint8_t* at = strm.patch(c.head, 2)) at[1] = static_cast<uint8_t>(count);
+			} else {
+				// Widen the head: grow the output, then move the contents over.
+				byte head[9];
+				size_t n     = encodeHead(head, majorType, count);
+				size_t extra = n - 2;
+				size_t body  = strm.size() - c.head - 2;
+				const byte zeros[8] = {};
+				write(zeros, extra);
+				if (uint8_t* at = strm.patch(c.head, n + body)) {
+					memmove(at + n, at + 2, body);
+					memcpy(at, head, n);
+				}
+			}
+		}
 	}
 
 	/*
-	inline void CborEncoder::push_value(const std::string& s) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const std::string& s) {
 		push_pos_integer(0b011, s.length());
 		write((const uint8_t*)s.data(), s.length());
 	}
 	*/
-	inline void CborEncoder::push_value(const char* s, size_t len) {
-		push_pos_integer(0b011, len);
-		write((const uint8_t*)s, len);
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const char* s, size_t len) {
+		counted();
+		write_string(0b011, (const uint8_t*)s, len);
 	}
-	inline void CborEncoder::push_value(const uint8_t* s, size_t len) {
-		push_pos_integer(0b010, len);
-		write(s, len);
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const uint8_t* s, size_t len) {
+		counted();
+		write_string(0b010, s, len);
 	}
 
-	inline void CborEncoder::push_value(const TextBuffer& tb) {
-		push_pos_integer(0b011, tb.len);
-		write((const uint8_t*)tb.buf, tb.len);
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const TextBuffer& tb) {
+		counted();
+		write_string(0b011, (const uint8_t*)tb.buf, tb.len);
 	}
-	inline void CborEncoder::push_value(const ByteBuffer& bb) {
-		push_pos_integer(0b010, bb.len);
-		write((const uint8_t*)bb.buf, bb.len);
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const ByteBuffer& bb) {
+		counted();
+		write_string(0b010, (const uint8_t*)bb.buf, bb.len);
 	}
 
 	// WARNING: Once again, we assume the host machine is little-endian.
 
-	inline void CborEncoder::push_value(const TypedArrayBuffer& tab) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_value(const TypedArrayBuffer& tab) {
 		switch (tab.type) {
 			case TypedArrayBuffer::eUInt8:
 				push_typed_array((const uint8_t*)tab.buf, tab.elementLength());
@@ -311,30 +843,42 @@ namespace cbor {
 		}
 	}
 
-	inline void CborEncoder::push_typed_array(const float* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const float* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b11101 });
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(float) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(float) * len);
 	}
-	inline void CborEncoder::push_typed_array(const double* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const double* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b11110 });
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(double) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(double) * len);
 	}
 
-	inline void CborEncoder::push_typed_array(const uint8_t* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const uint8_t* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b00100 }); // integral, unsigned, little-endian, size=8bit
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(uint8_t) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(uint8_t) * len);
 	}
-	inline void CborEncoder::push_typed_array(const int32_t* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const int32_t* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b01110 }); // integral, signed, little-endian, size=32bit
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(int32_t) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(int32_t) * len);
 	}
-	inline void CborEncoder::push_typed_array(const int64_t* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const int64_t* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b01111 }); // integral, signed, little-endian, size=64bit
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(int64_t) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(int64_t) * len);
 	}
-	inline void CborEncoder::push_typed_array(const uint64_t* vs, size_t len) {
+	template <class Sink>
+	inline void BasicCborEncoder<Sink>::push_typed_array(const uint64_t* vs, size_t len) {
+		counted();
 		push_pos_integer(0b110, uint64_t { 0b010'00000 | 0b00111 }); // integral, unsigned, little-endian, size=64bit
-		push_value(reinterpret_cast<const uint8_t*>(vs), sizeof(uint64_t) * len);
+		write_string(0b010, reinterpret_cast<const uint8_t*>(vs), sizeof(uint64_t) * len);
 	}
 
 
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "cbor_tree_parser.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+
+//
+// Parallel tree building for large top-level containers.
+//
+// `parseTreeParallel` first scans the children of the root array or map serially, skipping over their encodings to
+// find where each one starts. That scan only reads heads, so it is much cheaper than building nodes. The children are
+// then split into contiguous ranges of about equal encoded size, and each range is parsed with `parseOne` on its own
+// thread, straight into the root's children array.
+//
+// Only the root level is split, so this pays off for roots with many children (a big array of records, say), not for
+// a root with a few huge children. A root that is not a container, or a single thread, parses serially.
+//
+// With `arenas`, each thread allocates from its own arena (the vector is grown to the number of threads). The tree
+// views `data`, which must outlive it, as with `parseTree` over a `BinStreamBuffer`.
+//
+
+namespace cbor {
+
+	template <size_t MaxDepth = kDefaultMaxDepth>
+	inline Node parseTreeParallel(const byte* data, size_t len, size_t threads = 0, std::vector<Arena>* arenas = nullptr) {
+		using Parser = BasicCborParser<BinStreamBuffer, MaxDepth>;
+
+		if (threads == 0) threads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+		if (arenas and arenas->empty()) arenas->resize(1);
+		auto arenaFor = [&](size_t t) { return arenas ? &(*arenas)[t] : nullptr; };
+
+		BinStreamBuffer strm(data, len);
+		Item head = readItem(strm);
+		if (threads == 1 or (head.type != ItemType::BeginArray and head.type != ItemType::BeginMap)) {
+			return parseTree(Parser(BinStreamBuffer{data, len}), arenaFor(0));
+		}
+		bool map = head.type == ItemType::BeginMap;
+
+		// Serial boundary scan: where each element (or pair) starts, plus where the last one ends.
+		std::vector<size_t> starts;
+		if (head.size != kIndefiniteLength) starts.reserve(head.size + 1);
+		while (true) {
+			if (head.size != kIndefiniteLength and starts.size() == head.size) break;
+			if (!strm.hasMore()) throw std::runtime_error("cbor: input ended inside a container.");
+			if (head.size == kIndefiniteLength and data[strm.cursor()] == 0xff) break;
+			starts.push_back(strm.cursor());
+			skipItems<MaxDepth - 1>(strm, map ? 2 : 1);
+		}
+		size_t n = starts.size();
+		starts.push_back(strm.cursor());
+
+		threads = std::max<size_t>(1, std::min(threads, n));
+		if (arenas and arenas->size() < threads) arenas->resize(threads);
+
+		Node root = map ? Node::allocMap(n, arenaFor(0)) : Node::allocVec(n, arenaFor(0));
+
+		// Ranges of children `[bounds[t], bounds[t+1])`, split by encoded size.
+		std::vector<size_t> bounds(threads + 1, n);
+		bounds[0] = 0;
+		size_t first = starts[0], total = starts[n] - first;
+		for (size_t t=1; t<threads; t++) {
+			size_t target = first + total * t / threads;
+			bounds[t] = std::max(bounds[t - 1], size_t(std::lower_bound(starts.begin(), starts.end() - 1, target) - starts.begin()));
+		}
+
+		std::vector<std::exception_ptr> errors(threads);
+		auto work = [&](size_t t) {
+			try {
+				size_t b = bounds[t], e = bounds[t + 1];
+				if (b == e) return;
+				Parser p(BinStreamBuffer{data + starts[b], starts[e] - starts[b]});
+				std::vector<Node> scratch;
+				Arena* arena = arenaFor(t);
+				for (size_t i=b; i<e; i++) {
+					if (map) {
+						root.kvs[i].first  = parseOne(p, p.next(), arena, scratch);
+						root.kvs[i].second = parseOne(p, p.next(), arena, scratch);
+					} else {
+						root.elems[i] = parseOne(p, p.next(), arena, scratch);
+					}
+				}
+			} catch (...) {
+				errors[t] = std::current_exception();
+			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+		for (size_t t=1; t<threads; t++) pool.emplace_back(work, t);
+		work(0);
+		for (auto& th : pool) th.join();
+
+		for (auto& e : errors)
+			if (e) std::rethrow_exception(e);
+		return root;
+	}
+
+}
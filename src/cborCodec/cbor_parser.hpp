@@ -1,17 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <deque>
 #include <fstream>
 #include <limits>
+#include <memory>
 #include <stdexcept>
 #include <string_view>
 #include <type_traits>
 #include <vector>
-#include <variant>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <cstring>
 #include <optional>
 
@@ -27,7 +32,28 @@
 
 namespace cbor {
 
+		//
+		// Input streams.
+		//
+		// `BasicCborParser` is templated on the stream type, so that every byte read compiles down to
+		// direct calls on the concrete stream (pointer arithmetic for `BinStreamBuffer`) with no runtime dispatch.
+		// A stream must provide:
+		//
+		//     bool hasMore(size_t n = 1);         // are there at least `n` more bytes?
+		//     uint8_t nextByte();
+		//     template <class V> V nextValue();   // read `sizeof(V)` raw (unswapped) bytes
+		//     uint64_t nextArgument(uint8_t w);   // read a big-endian unsigned of width 1, 2, 4 or 8
+		//     const uint8_t* nextBytes(size_t n); // pointer to the next `n` contiguous bytes
+		//     void skip(size_t n);                // move past `n` bytes without reading them
+		//     size_t pos() const;                 // bytes consumed so far (for error reporting)
+		//     static constexpr bool kStableViews; // do pointers from `nextBytes` live as long as the input?
+		//
+		// Only `hasMore()` checks bounds. The read functions may assume the caller checked.
+		//
+
         struct BinStreamBuffer {
+			static constexpr bool kStableViews = true;
+
             inline BinStreamBuffer(const uint8_t* data, size_t len)
                 : data(data)
                 , len(len) {
@@ -39,9 +65,10 @@ namespace cbor {
             size_t cursor_ = 0;
 
 			inline size_t cursor() const { return cursor_; }
+			inline size_t pos() const { return cursor_; }
 
             inline bool hasMore(size_t n = 1) const {
-                return cursor_ + n <= len;
+                return n <= len - cursor_; // Not `cursor_ + n`, which overflows for bogus lengths.
             }
             inline uint8_t nextByte() {
                 assert(hasMore());
@@ -58,170 +85,470 @@ namespace cbor {
                 return v;
             }
 
-			/*
+			// With 8 readable bytes we can do one unaligned load, swap, and shift off the bytes that aren't ours.
+			inline uint64_t nextArgument(uint8_t width) {
+				assert(hasMore(width));
+				uint64_t v;
+				if (cursor_ + 8 <= len) {
+					uint64_t raw;
+					memcpy(&raw, data + cursor_, 8);
+					v = __builtin_bswap64(raw) >> (64 - 8 * width);
+				} else {
+					v = loadArgument(data + cursor_, width);
+				}
+				cursor_ += width;
+				return v;
+			}
+
             inline const uint8_t* nextBytes(size_t n) {
                 assert(hasMore(n));
                 auto out = data + cursor_;
                 cursor_ += n;
                 return out;
             }
-			*/
-			inline DataBuffer nextBytes(size_t n) {
-                assert(hasMore(n));
-                auto ptr = data + cursor_;
-                cursor_ += n;
-                return DataBuffer(ptr, n); // view.
+
+			inline void skip(size_t n) {
+				assert(hasMore(n));
+				cursor_ += n;
 			}
 
 			inline bool valid() const { return data != 0; }
         };
 
+		//
+		// A block-buffered file stream.
+		//
+		// The file is read in large blocks into one of two windows (each `windowSize` bytes). When the active window
+		// runs dry, its unread tail is carried over to the *other* window, which is then topped up from the file.
+		// Bytes remaining are tracked from the file size, so `hasMore()` never touches the `ifstream`.
+		//
+		// `nextBytes()` returns a pointer into the active window when the string lies entirely inside of it. Strings that
+		// straddle the window end (or are larger than a window) are copied into one of two scratch buffers owned by the
+		// stream, which keep their capacity, so there is no allocation per string in the steady state.
+		// Because a refill only ever overwrites the window *before* the active one, and the scratch buffers alternate too,
+		// a pointer stays valid until the item after next has been read: long enough for a map key and its value to be
+		// alive at the same time. Anything that must outlive that (e.g. a `Node` tree) has to copy, which is what
+		// `kStableViews` signals.
+		//
         struct BinStreamFile {
-            inline BinStreamFile(const std::string& path) : ifs(path, std::ios_base::in | std::ios_base::binary), isSet(true) {}
-            inline BinStreamFile(std::ifstream&& ifs) : ifs(std::move(ifs)), isSet(true) {}
+			static constexpr size_t kDefaultWindowSize = 1 << 20;
+			static constexpr size_t kMinWindowSize     = 64;
+			static constexpr bool kStableViews         = false;
+
+            inline BinStreamFile(const std::string& path, size_t windowSize = kDefaultWindowSize)
+				: ifs(path, std::ios_base::in | std::ios_base::binary), isSet(true) {
+				init(windowSize);
+			}
+            inline BinStreamFile(std::ifstream&& ifs, size_t windowSize = kDefaultWindowSize)
+				: ifs(std::move(ifs)), isSet(true) {
+				init(windowSize);
+			}
             inline BinStreamFile() : isSet(false) {}
 
 			inline bool valid() const { return isSet; }
 
-            inline bool hasMore(ssize_t n = 1) {
-				ifs.seekg(n, std::ios_base::cur);
-				ifs.peek(); // ifstream eof not updated unless we read (or peek)
-				bool eof = ifs.eof() or ifs.tellg() == -1;
-				ifs.seekg(-n, std::ios_base::cur);
-                return !eof;
+            inline bool hasMore(size_t n = 1) const {
+                return (end_ - cursor_) + fileRemaining_ >= n;
             }
             inline uint8_t nextByte() {
-                assert(hasMore());
-				uint8_t out;
-                ifs.read((char*)&out, 1);
-				return out;
+				if (cursor_ == end_) refill(1);
+				return window_[cursor_++];
             }
             template <class V> inline V nextValue() {
+				if (end_ - cursor_ < sizeof(V)) refill(sizeof(V));
 				V v;
-				ifs.read((char*)&v, sizeof(V));
+				memcpy(&v, window_.get() + cursor_, sizeof(V));
+				cursor_ += sizeof(V);
                 return v;
             }
-            inline DataBuffer nextBytes(size_t n) {
+			inline uint64_t nextArgument(uint8_t width) {
+				if (end_ - cursor_ < width) refill(width);
+				uint64_t v = loadArgument(window_.get() + cursor_, width);
+				cursor_ += width;
+				return v;
+			}
+            inline const uint8_t* nextBytes(size_t n) {
                 assert(hasMore(n));
-                DataBuffer db(n); // allocate + own.
-				ifs.read((char*)db.buf, n);
-                return db;
+				size_t avail = end_ - cursor_;
+				if (n <= avail) {
+					auto ptr = window_.get() + cursor_;
+					cursor_ += n;
+					return ptr;
+				}
+
+				// Straddles the window end: copy what we have, read the rest straight from the file.
+				auto& scratch = scratch_[scratchIdx_ ^= 1];
+				if (scratch.size() < n) scratch.resize(n);
+				memcpy(scratch.data(), window_.get() + cursor_, avail);
+				ifs.read((char*)scratch.data() + avail, n - avail);
+				fileRemaining_ -= n - avail;
+				consumed_ += n - avail;
+				cursor_ = end_;
+                return scratch.data();
             }
 
-            size_t pos () { return ifs.tellg(); }
+			inline void skip(size_t n) {
+				assert(hasMore(n));
+				size_t avail = end_ - cursor_;
+				if (n <= avail) {
+					cursor_ += n;
+					return;
+				}
+
+				// Past the loaded data: seek over the rest, the next read will refill.
+				size_t rest = n - avail;
+				ifs.seekg(rest, std::ios_base::cur);
+				fileRemaining_ -= rest;
+				consumed_ += rest;
+				cursor_ = end_;
+			}
+
+            inline size_t pos() const { return startPos_ + consumed_ + cursor_ - windowBegin_; }
 
-			// private:
+			private:
+
+			inline void init(size_t windowSize) {
+				windowSize_ = std::max(windowSize, kMinWindowSize);
+				window_.reset(new byte[2 * windowSize_]);
+
+				auto here = ifs.tellg();
+				if (here == std::streampos(-1)) return; // Not open: behaves like an empty file.
+				ifs.seekg(0, std::ios_base::end);
+				fileRemaining_ = static_cast<size_t>(ifs.tellg() - here);
+				ifs.seekg(here);
+				startPos_ = static_cast<size_t>(std::streamoff(here));
+			}
+
+			// Make at least `n` bytes available at `cursor_`, switching to the other window.
+			inline void refill(size_t n) {
+				assert(n <= windowSize_);
+				size_t tail = end_ - cursor_;
+				size_t otherBegin = windowBegin_ == 0 ? windowSize_ : 0;
+				byte* dst = window_.get() + otherBegin;
+				memmove(dst, window_.get() + cursor_, tail);
+
+				size_t toRead = std::min(windowSize_ - tail, fileRemaining_);
+				ifs.read((char*)dst + tail, toRead);
+				fileRemaining_ -= toRead;
+
+				consumed_ += cursor_ - windowBegin_;
+				windowBegin_ = otherBegin;
+				cursor_ = otherBegin;
+				end_ = otherBegin + tail + toRead;
+				assert(end_ - cursor_ >= n && "unexpected end of file");
+			}
 
 			std::ifstream ifs;
 			bool isSet;
 
+			std::unique_ptr<byte[]> window_;
+			size_t windowSize_    = 0;
+			size_t windowBegin_   = 0; // Offset of the active window inside `window_` (0 or `windowSize_`)
+			size_t cursor_        = 0;
+			size_t end_           = 0;
+			size_t fileRemaining_ = 0; // Bytes in the file not yet loaded into a window.
+			size_t consumed_      = 0; // Bytes consumed in previous windows.
+			size_t startPos_      = 0;
+
+			std::vector<byte> scratch_[2];
+			int scratchIdx_ = 0;
+
 		};
 
-		struct BinStreamUnion {
-			BinStreamBuffer strm1;
-			BinStreamFile   strm2;
-			
-			inline BinStreamUnion(BinStreamBuffer&& s) : strm1(std::move(s)) {}
-			inline BinStreamUnion(BinStreamFile&& s) : strm2(std::move(s)) {}
+		//
+		// A read-only memory mapping of a whole file.
+		//
+		// The kernel is told we will read it front-to-back (`MADV_SEQUENTIAL`) and soon (`MADV_WILLNEED`), so read-ahead
+		// is aggressive and pages behind the cursor are dropped early. This lets us parse files far larger than RAM.
+		// `hugePages` additionally asks for transparent huge pages, which only has an effect on filesystems that support them.
+		//
+		struct MappedFile {
+			inline MappedFile(const std::string& path, bool hugePages = false) {
+				int fd = ::open(path.c_str(), O_RDONLY);
+				if (fd < 0) throw std::runtime_error("cbor::MappedFile failed to open: " + path);
+
+				struct stat st;
+				if (::fstat(fd, &st) != 0) {
+					::close(fd);
+					throw std::runtime_error("cbor::MappedFile failed to stat: " + path);
+				}
+				len_ = static_cast<size_t>(st.st_size);
+
+				if (len_ > 0) {
+					void* ptr = ::mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (ptr == MAP_FAILED) {
+						::close(fd);
+						throw std::runtime_error("cbor::MappedFile failed to mmap: " + path);
+					}
+					data_ = static_cast<const byte*>(ptr);
+
+					// Advice is best-effort: ignore failures.
+					::madvise(ptr, len_, MADV_SEQUENTIAL);
+					::madvise(ptr, len_, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+					if (hugePages) ::madvise(ptr, len_, MADV_HUGEPAGE);
+#endif
+				}
 
-			inline bool valid() const { return strm1.valid() ? strm1.valid() : strm2.valid(); }
+				// The mapping stays valid after closing the descriptor.
+				::close(fd);
+			}
 
-            inline bool hasMore(size_t n = 1) {
-                return strm1.valid() ? strm1.hasMore(n) : strm2.hasMore(n);
-            }
-            inline uint8_t nextByte() {
-                return strm1.valid() ? strm1.nextByte() : strm2.nextByte();
-            }
-            template <class V> inline V nextValue() {
-                return strm1.valid() ? strm1.nextValue<V>() : strm2.nextValue<V>();
-            }
-            inline DataBuffer nextBytes(size_t n) {
-                return strm1.valid() ? strm1.nextBytes(n) : strm2.nextBytes(n);
-            }
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			inline MappedFile(MappedFile&& o) : data_(o.data_), len_(o.len_) {
+				o.data_ = nullptr;
+				o.len_ = 0;
+			}
+
+			inline ~MappedFile() {
+				if (data_) ::munmap((void*)data_, len_);
+			}
+
+			inline const byte* data() const { return data_; }
+			inline size_t size() const { return len_; }
+
+			private:
+			const byte* data_ = nullptr;
+			size_t len_ = 0;
 		};
 
+		//
+		// Parses out of a refcounted input slab. `slab()` points at the first byte, and its control block owns the memory,
+		// whatever that is (a vector, a receive buffer, a mapping).
+		//
+		// Views handed out by this stream are valid as long as *some* reference to the slab is alive. To make a view that
+		// keeps it alive by itself, e.g. a `TypedArrayBuffer` handed to another thread, set the buffer's `owner` to `slab()`.
+		// `parseShared` does this for whole trees.
+		//
+		struct BinStreamShared : public BinStreamBuffer {
+			inline BinStreamShared(std::shared_ptr<const byte> slab, size_t len)
+				: BinStreamBuffer(slab.get(), len), slab_(std::move(slab)) {}
+
+			inline static BinStreamShared fromVector(std::vector<uint8_t>&& data) {
+				auto holder = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+				return BinStreamShared(std::shared_ptr<const byte>(holder, holder->data()), holder->size());
+			}
+
+			inline const std::shared_ptr<const byte>& slab() const { return slab_; }
+
+			private:
+			std::shared_ptr<const byte> slab_;
+		};
+
+		//
+		// Parses straight out of a `MappedFile`. Text, byte strings and typed arrays are zero-copy views into the mapping.
+		//
+		// The mapping is the slab: views are valid as long as *some* reference to it is alive, so if a `Node` tree must
+		// outlive the parser, hold on to `mapping()` (or use `parseShared`).
+		//
+		struct BinStreamMapped : public BinStreamShared {
+			inline BinStreamMapped(const std::string& path, bool hugePages = false)
+				: BinStreamMapped(std::make_shared<const MappedFile>(path, hugePages)) {}
+
+			inline BinStreamMapped(std::shared_ptr<const MappedFile> mapping)
+				: BinStreamShared(std::shared_ptr<const byte>(mapping, mapping->data()), mapping->size()), mapping_(std::move(mapping)) {}
+
+			inline const std::shared_ptr<const MappedFile>& mapping() const { return mapping_; }
+
+			private:
+			std::shared_ptr<const MappedFile> mapping_;
+		};
+
+		// Maximum container nesting a parser tracks by default. Deeper input is reported as an error.
+		constexpr size_t kDefaultMaxDepth = 64;
+
         enum class Mode : uint8_t { root, array, map };
+
+		// NOTE: No default member initializers, so that the parser's inline stack is not initialized on construction.
         struct State {
-            Mode mode = Mode::root;
-            size_t byteIdx=0;     // This is not update, it's frozen at start.
-            size_t sequenceIdx=0; // This is updated *in-place*
-            size_t len= kIndefiniteLength;         // If the mode is array or map, how many elements are there? (or kIndefiniteLength)
-			int depth = 0;
+            Mode mode;
+            size_t sequenceIdx; // This is updated *in-place*: items seen so far (keys and values both count for a map)
+            size_t len;         // How many items are there (twice the pair count for a map)? (or kIndefiniteLength)
 
             inline bool operator==(const Mode& m) {
                 return mode == m;
             }
         };
 
+		//
+		// Errors reported by the non-throwing API (`tryNext`, `trySkipValue`), with the offset of the offending item.
+		// The throwing API raises a `std::runtime_error` carrying the same message instead.
+		//
+		enum class DecodeError : uint8_t {
+			None,
+			Truncated,          // The input ends inside an item
+			UnexpectedBreak,    // A break byte outside of an indefinite-length container
+			NestingTooDeep,     // More than `MaxDepth` open containers
+			UnsupportedTag,     // Only RFC8746 typed array tags are supported
+			ExpectedByteString, // A typed array tag not followed by a byte string
+			UnsupportedFloat,   // Half floats (other than infinities and NaN), float16 and float128 typed arrays
+			IndefiniteString,   // Indefinite-length text or byte strings
+			Reserved            // Reserved additional information values
+		};
+
+		inline const char* toString(DecodeError e) {
+			switch (e) {
+				case DecodeError::None: return "cbor: no error.";
+				case DecodeError::Truncated: return "cbor: input ends inside an item.";
+				case DecodeError::UnexpectedBreak: return "cbor: unexpected break byte.";
+				case DecodeError::NestingTooDeep: return "cbor: maximum nesting depth exceeded.";
+				case DecodeError::UnsupportedTag: return "unsupported tag data encountered.";
+				case DecodeError::ExpectedByteString: return "while parsing typed array, expected byte string.";
+				case DecodeError::UnsupportedFloat: return "half floats are not supported.";
+				case DecodeError::IndefiniteString: return "Indefinite length strings are NOT supported by this decoder.";
+				case DecodeError::Reserved: return "not supported";
+			}
+			return "impossible";
+		}
+
+		struct DecodeStatus {
+			DecodeError error = DecodeError::None;
+			size_t offset     = 0; // Stream position of the item that failed to decode
+
+			inline bool ok() const { return error == DecodeError::None; }
+			inline explicit operator bool() const { return ok(); }
+
+			inline std::string message() const {
+				return std::string { toString(error) } + " (at byte " + std::to_string(offset) + ")";
+			}
+		};
+
 		struct BeginArray { size_t size; };
 		struct BeginMap { size_t size; };
-		struct EndArray {};
-		struct EndMap {};
 		struct End {};
 
-	using Value = std::variant<
-		uint8_t, int64_t, uint64_t,
-		float, double,
-		bool,
-		// TextStringView,
-		// ByteStringView,
-		// TypedArrayView,
-		TextBuffer, ByteBuffer, TypedArrayBuffer,
-		BeginArray, BeginMap, EndArray, EndMap,
-		Null,
-		End
-		>;
+	enum class ItemType : uint8_t {
+		Byte, Int64, Uint64, F32, F64, Bool, Text, Bytes, TypedArray, BeginArray, BeginMap, Null, End
+	};
+
+	namespace {
+		template <class T> constexpr ItemType itemTypeOf() {
+			if constexpr (std::is_same_v<T, uint8_t>) return ItemType::Byte;
+			else if constexpr (std::is_same_v<T, int64_t>) return ItemType::Int64;
+			else if constexpr (std::is_same_v<T, uint64_t>) return ItemType::Uint64;
+			else if constexpr (std::is_same_v<T, float>) return ItemType::F32;
+			else if constexpr (std::is_same_v<T, double>) return ItemType::F64;
+			else if constexpr (std::is_same_v<T, bool>) return ItemType::Bool;
+			else if constexpr (std::is_same_v<T, TextBuffer>) return ItemType::Text;
+			else if constexpr (std::is_same_v<T, ByteBuffer>) return ItemType::Bytes;
+			else if constexpr (std::is_same_v<T, TypedArrayBuffer>) return ItemType::TypedArray;
+			else if constexpr (std::is_same_v<T, BeginArray>) return ItemType::BeginArray;
+			else if constexpr (std::is_same_v<T, BeginMap>) return ItemType::BeginMap;
+			else if constexpr (std::is_same_v<T, Null>) return ItemType::Null;
+			else if constexpr (std::is_same_v<T, End>) return ItemType::End;
+			else static_assert(!sizeof(T), "not a type an Item can hold");
+		}
+	}
 
+	//
+	// A decoded token.
+	//
+	// This used to hold a reference to the parser's stack and a `std::variant` of owning buffers, but on the hot path all that
+	// is needed is the type, a 64-bit payload (the scalar, or the length of a string/container) and a pointer for strings.
+	// So `Item` is trivially copyable and is passed around by value.
+	//
+	// Text, byte strings and typed arrays point into the stream: for buffer/mapped input they live as long as the input,
+	// for `BinStreamFile` they live until the item after next has been read (see `BinStreamFile`).
+	//
 	struct Item {
-		std::vector<State>& stack;
-		Value value;
+		ItemType type = ItemType::End;
+		uint8_t taType = 0;   // `TypedArrayBuffer::Type` when `type == TypedArray`
+		uint8_t taEndian = 1; // 0 big, 1 little
+
+		union {
+			uint8_t byte;
+			int64_t int64;
+			uint64_t uint64;
+			float f32;
+			double f64;
+			bool boolean;
+			size_t size; // Byte length for strings and typed arrays, element count for arrays, pair count for maps
+		};
 
-		inline operator Value&() { return value; }
-		inline const State& state() const { return stack.back(); }
+		const uint8_t* ptr = nullptr;
+
+		inline Item() : uint64(0) {}
+		inline Item(ItemType type, uint64_t v) : type(type), uint64(v) {}
+
+		inline static Item fromByte(uint8_t v) { Item i(ItemType::Byte, 0); i.byte = v; return i; }
+		inline static Item fromInt(int64_t v) { Item i(ItemType::Int64, 0); i.int64 = v; return i; }
+		inline static Item fromUint(uint64_t v) { return Item(ItemType::Uint64, v); }
+		inline static Item fromFloat(float v) { Item i(ItemType::F32, 0); i.f32 = v; return i; }
+		inline static Item fromDouble(double v) { Item i(ItemType::F64, 0); i.f64 = v; return i; }
+		inline static Item fromBool(bool v) { Item i(ItemType::Bool, 0); i.boolean = v; return i; }
+		inline static Item fromNull() { return Item(ItemType::Null, 0); }
+		inline static Item fromEnd() { return Item(ItemType::End, 0); }
+		inline static Item fromBeginArray(size_t n) { return Item(ItemType::BeginArray, n); }
+		inline static Item fromBeginMap(size_t n) { return Item(ItemType::BeginMap, n); }
+		inline static Item fromData(ItemType type, const uint8_t* ptr, size_t len) {
+			Item i(type, len);
+			i.ptr = ptr;
+			return i;
+		}
 
-		template <class T> inline T& expect() { return std::get<T>(value); }
+		template<class T>
+		inline bool is() const {
+			return type == itemTypeOf<T>();
+		}
+
+		// Returns the held value. Buffers are returned as views.
+		template <class T> inline T expect() const {
+			assert(is<T>());
+			if constexpr (std::is_same_v<T, uint8_t>) return byte;
+			else if constexpr (std::is_same_v<T, int64_t>) return int64;
+			else if constexpr (std::is_same_v<T, uint64_t>) return uint64;
+			else if constexpr (std::is_same_v<T, float>) return f32;
+			else if constexpr (std::is_same_v<T, double>) return f64;
+			else if constexpr (std::is_same_v<T, bool>) return boolean;
+			else if constexpr (std::is_same_v<T, TextBuffer>) return TextBuffer(ptr, size);
+			else if constexpr (std::is_same_v<T, ByteBuffer>) return ByteBuffer(ptr, size);
+			else if constexpr (std::is_same_v<T, TypedArrayBuffer>)
+				return TypedArrayBuffer(DataBuffer(ptr, size), static_cast<TypedArrayBuffer::Type>(taType), taEndian);
+			else if constexpr (std::is_same_v<T, BeginArray>) return BeginArray { size };
+			else if constexpr (std::is_same_v<T, BeginMap>) return BeginMap { size };
+			else return T{};
+		}
 
 		inline std::string toString() const {
 			char buf[32] = {0};
-			bool done = false;
-			if (std::holds_alternative<uint8_t>(value)) sprintf(buf, "%ld", (int64_t)std::get<uint8_t>(value)), done = true;
-			else if (std::holds_alternative<bool>(value)) sprintf(buf, std::get<bool>(value) ? "true" : "false"), done = true;
-			else if (std::holds_alternative<uint64_t>(value)) sprintf(buf, "%lu", std::get<uint64_t>(value)), done = true;
-			else if (std::holds_alternative<int64_t>(value)) sprintf(buf, "%ld", std::get<int64_t>(value)), done = true;
-			else if (std::holds_alternative<float>(value)) sprintf(buf, "%f", std::get<float>(value)), done = true;
-			else if (std::holds_alternative<double>(value)) sprintf(buf, "%lf", std::get<double>(value)), done = true;
-			else if (std::holds_alternative<Null>(value)) sprintf(buf, "null"), done = true;
-			else if (std::holds_alternative<End>(value)) sprintf(buf, "end"), done = true;
-			else if (std::holds_alternative<BeginArray>(value)) sprintf(buf, "["), done = true;
-			else if (std::holds_alternative<EndArray>(value)) sprintf(buf, "]"), done = true;
-			else if (std::holds_alternative<BeginMap>(value)) sprintf(buf, "{"), done = true;
-			else if (std::holds_alternative<EndMap>(value)) sprintf(buf, "}"), done = true;
-
-			if (done) { return std::string{buf}; }
-
-			if (std::holds_alternative<TextBuffer>(value)) return "\"" + std::string{std::get<TextBuffer>(value).asStringView()} + "\"";
-			if (std::holds_alternative<ByteBuffer>(value)) printf("bstr{len=%ld}", std::get<ByteBuffer>(value).size());
-			if (std::holds_alternative<TypedArrayBuffer>(value)) printf("tav{len=%ld}", std::get<TypedArrayBuffer>(value).size());
-
-			return std::string{"<unknown>"};
+			switch (type) {
+				case ItemType::Byte: sprintf(buf, "%ld", (int64_t)byte); break;
+				case ItemType::Bool: sprintf(buf, boolean ? "true" : "false"); break;
+				case ItemType::Uint64: sprintf(buf, "%lu", uint64); break;
+				case ItemType::Int64: sprintf(buf, "%ld", int64); break;
+				case ItemType::F32: sprintf(buf, "%f", f32); break;
+				case ItemType::F64: sprintf(buf, "%lf", f64); break;
+				case ItemType::Null: sprintf(buf, "null"); break;
+				case ItemType::End: sprintf(buf, "end"); break;
+				case ItemType::BeginArray: sprintf(buf, "["); break;
+				case ItemType::BeginMap: sprintf(buf, "{"); break;
+				case ItemType::Text: return "\"" + std::string{(const char*)ptr, size} + "\"";
+				case ItemType::Bytes: sprintf(buf, "bstr{len=%ld}", size); break;
+				case ItemType::TypedArray: sprintf(buf, "tav{len=%ld}", size); break;
+				default: return std::string{"<unknown>"};
+			}
+			return std::string{buf};
 		}
 
 		inline void print() const {
-			if (std::holds_alternative<uint8_t>(value)) printf("byte{%ld}", (int64_t)std::get<uint8_t>(value));
-			else if (std::holds_alternative<uint64_t>(value)) printf("ulong{%lu}", std::get<uint64_t>(value));
-			else if (std::holds_alternative<int64_t>(value)) printf("long{%ld}", std::get<int64_t>(value));
-			else if (std::holds_alternative<float>(value)) printf("f32{%f}", std::get<float>(value));
-			else if (std::holds_alternative<double>(value)) printf("f64{%lf}", std::get<double>(value));
-			else if (std::holds_alternative<TextBuffer>(value)) printf("str{%s}", std::string{std::get<TextBuffer>(value).asStringView()}.c_str());
-			else if (std::holds_alternative<ByteBuffer>(value)) printf("bstr{%ld}", std::get<ByteBuffer>(value).size());
-			else if (std::holds_alternative<Null>(value)) printf("null");
-			else if (std::holds_alternative<End>(value)) printf("end");
-			else if (std::holds_alternative<TypedArrayBuffer>(value)) printf("tav{%ld}", std::get<TypedArrayBuffer>(value).size());
-			else if (std::holds_alternative<BeginArray>(value)) printf("beginArray{");
-			else if (std::holds_alternative<EndArray>(value)) printf("}endArray");
-			else if (std::holds_alternative<BeginMap>(value)) printf("beginMap{");
-			else if (std::holds_alternative<EndMap>(value)) printf("}endMap");
-			else printf("<unknown>");
+			switch (type) {
+				case ItemType::Byte: printf("byte{%ld}", (int64_t)byte); break;
+				case ItemType::Bool: printf("bool{%s}", boolean ? "true" : "false"); break;
+				case ItemType::Uint64: printf("ulong{%lu}", uint64); break;
+				case ItemType::Int64: printf("long{%ld}", int64); break;
+				case ItemType::F32: printf("f32{%f}", f32); break;
+				case ItemType::F64: printf("f64{%lf}", f64); break;
+				case ItemType::Text: printf("str{%s}", std::string{(const char*)ptr, size}.c_str()); break;
+				case ItemType::Bytes: printf("bstr{%ld}", size); break;
+				case ItemType::Null: printf("null"); break;
+				case ItemType::End: printf("end"); break;
+				case ItemType::TypedArray: printf("tav{%ld}", size); break;
+				case ItemType::BeginArray: printf("beginArray{"); break;
+				case ItemType::BeginMap: printf("beginMap{"); break;
+				default: printf("<unknown>");
+			}
 		}
 
 		inline void print(const char* before, const char* after) const {
@@ -230,326 +557,498 @@ namespace cbor {
 			printf("%s", after);
 		}
 
-		template<class T>
-		inline bool is() const {
-			return std::holds_alternative<T>(value);
-		}
-
 		inline std::optional<int64_t> asInt() const {
-			if (this->is<int64_t>())
-				return std::get<int64_t>(value);
-			if (this->is<uint64_t>())
-				return std::get<uint64_t>(value);
-			if (this->is<uint8_t>())
-				return std::get<uint8_t>(value);
+			if (type == ItemType::Int64) return int64;
+			if (type == ItemType::Uint64) return uint64;
+			if (type == ItemType::Byte) return byte;
 			return {};
 		}
 		inline std::optional<uint64_t> asUInt() const {
-			if (this->is<int64_t>())
-				return std::get<int64_t>(value);
-			if (this->is<uint64_t>())
-				return std::get<uint64_t>(value);
-			if (this->is<int64_t>())
-				return std::get<uint8_t>(value);
+			if (type == ItemType::Int64) return int64;
+			if (type == ItemType::Uint64) return uint64;
+			if (type == ItemType::Byte) return byte;
 			return {};
 		}
 		inline std::optional<float> asFloat() const {
-			if (this->is<float>()) return std::get<float>(value);
-			if (this->is<double>()) return std::get<double>(value);
+			if (type == ItemType::F32) return f32;
+			if (type == ItemType::F64) return f64;
 			return {};
 		}
 		inline std::optional<double> asDouble() const {
-			if (this->is<float>()) return std::get<float>(value);
-			if (this->is<double>()) return std::get<double>(value);
+			if (type == ItemType::F32) return f32;
+			if (type == ItemType::F64) return f64;
 			return {};
 		}
 		inline std::optional<std::string_view> asStringView() const {
-			if (is<TextBuffer>()) return std::get<TextBuffer>(value).asStringView();
+			if (type == ItemType::Text) return std::string_view((const char*)ptr, size);
 			return {};
 		}
 
 	};
 
-	struct CborParser {
+	static_assert(std::is_trivially_copyable_v<Item> and std::is_trivially_destructible_v<Item>);
+	static_assert(sizeof(Item) <= 24);
+
+	//
+	// The container stack is an inline array of `MaxDepth` entries above the root, so constructing a parser does no allocation.
+	// Containers deeper than that are reported with an exception rather than overflowing anything.
+	//
+	template <class Stream, size_t MaxDepth = kDefaultMaxDepth>
+	struct BasicCborParser {
 		private:
 		public:
-		BinStreamUnion strm;
-		std::vector<State> stack = { State{Mode::root}, };
+		Stream strm;
+
+		private:
+		State stack_[MaxDepth + 1]; // [0] is the root
+		size_t depth_ = 0;
 
 		public:
 
-        inline CborParser(BinStreamBuffer&& strm) : strm(std::move(strm)) {}
-        inline CborParser(BinStreamFile  && strm) : strm(std::move(strm)) {}
+		using StreamType = Stream;
+		static constexpr size_t kMaxDepth = MaxDepth;
+
+        inline BasicCborParser(Stream&& strm) : strm(std::move(strm)) {
+			stack_[0] = State { Mode::root, 0, kIndefiniteLength };
+		}
 
 		Item next();
 
+		//
+		// Like `next()`, but reports malformed or truncated input with an error code and the offset of the item instead of throwing.
+		// Bounds are checked once per item head and once per payload. On error, `out` is unspecified and the parser must not be used further.
+		//
+		DecodeStatus tryNext(Item& out);
+
+		// The innermost open container (or the root).
+		inline const State& state() const { return stack_[depth_]; }
+		inline size_t depth() const { return depth_; }
+
+		// Count one item in the current container, then close every container that is now complete.
 		inline void advance() {
-			auto &state = stack.back();
-			state.sequenceIdx++;
-			if (state.sequenceIdx >= state.len) {
-				stack.pop_back();
-				advance();
-			}
+			stack_[depth_].sequenceIdx++;
+			popFinished();
+		}
+
+		inline void popFinished() {
+			while (depth_ > 0 and stack_[depth_].sequenceIdx >= stack_[depth_].len) depth_--;
 		}
 
-		inline Item makeItem(Value&& v) {
+		inline Item makeItem(Item it) {
 			advance();
-			return Item { stack , std::move(v) };
+			return it;
 		}
 
-		// NOTE: `F` must take two `Item&&`' and can return either void or bool (false means break out of loop)
+		// The container header counts as an item of its parent. The parent cannot close before the child does,
+		// so we only pop after pushing (which also handles empty containers).
+		inline Item makeContainerItem(Item it, Mode mode, size_t len) {
+			assert(depth_ < MaxDepth);
+			stack_[depth_].sequenceIdx++;
+			stack_[++depth_] = State { mode, 0, len };
+			popFinished();
+			return it;
+		}
+
+		// A break byte closes the innermost indefinite-length container.
+		inline Item makeBreakItem() {
+			assert(depth_ > 0 and stack_[depth_].len == kIndefiniteLength);
+			depth_--;
+			popFinished();
+			return Item::fromEnd();
+		}
+
+		// NOTE: `F` must take two `Item`s (by value) and can return either void or bool (false means break out of loop)
 		template <class F>
 		void consumeMap(size_t size, F&& f);
 
+		//
+		// Skip the next value entirely (a container is skipped with all of its contents).
+		// Nothing is decoded into `Item`s: strings, byte strings and typed arrays are jumped over by moving the cursor
+		// (seeking, for files) and containers are walked by counting heads.
+		//
+		void skipValue();
+		DecodeStatus trySkipValue();
+
+		// Skip the rest of the innermost open container, including its break byte if it is indefinite, and close it.
+		// At the root, this skips to the end of the input.
+		//
+		// To skip a container `next()` just returned, pass that `BeginMap`/`BeginArray` item: an empty container is
+		// already closed when it is returned, and skipping "its" remainder would skip the rest of its parent instead.
+		void skipRemaining();
+		void skipRemaining(const Item& begin);
+
 		template <class F>
 		void consumeArray(size_t size, F&& f);
 
 		inline bool hasMore() {
 			return strm.hasMore();
 		}
-		
+
 	};
 
+	using CborParser       = BasicCborParser<BinStreamBuffer>;
+	using CborFileParser   = BasicCborParser<BinStreamFile>;
+	using CborMappedParser = BasicCborParser<BinStreamMapped>;
+	using CborSharedParser = BasicCborParser<BinStreamShared>;
+
+
+	//
+	// The element type of an RFC8746 typed array tag (`0b010'fsell`). Returns false for float16 and float128.
+	//
+	inline bool typedArrayType(uint64_t tag, TypedArrayBuffer::Type& type) {
+		uint8_t floating = (tag & 0b10000) != 0;
+		uint8_t signing  = (tag & 0b01000) != 0;
+		uint8_t ll       = tag & 0b00011;
+		if (floating and (ll == 0 or ll == 3))
+			return false;
+		else if (floating and ll == 1)
+			type = TypedArrayBuffer::eFloat32;
+		else if (floating and ll == 2)
+			type = TypedArrayBuffer::eFloat64;
+		else if (ll == 0 and !signing)
+			type = TypedArrayBuffer::eUInt8;
+		else if (ll == 0 and signing)
+			type = TypedArrayBuffer::eInt8;
+		else if (ll == 1 and !signing)
+			type = TypedArrayBuffer::eUInt16;
+		else if (ll == 1 and signing)
+			type = TypedArrayBuffer::eInt16;
+		else if (ll == 2 and !signing)
+			type = TypedArrayBuffer::eUInt32;
+		else if (ll == 2 and signing)
+			type = TypedArrayBuffer::eInt32;
+		else if (ll == 3 and !signing)
+			type = TypedArrayBuffer::eUInt64;
+		else
+			type = TypedArrayBuffer::eInt64;
+		return true;
+	}
 
-	inline Item CborParser::next() {
+	//
+	// Check the tag in front of a typed array, the same way wherever one is read or skipped: only RFC8746 typed array
+	// tags are supported, and of those not float16 and float128.
+	//
+	inline DecodeError tryTypedArrayTag(uint64_t tag, TypedArrayBuffer::Type& type) {
+		if (tag < 0b010'00000 or tag > 0b010'11111) return DecodeError::UnsupportedTag;
+		if (!typedArrayType(tag, type)) return DecodeError::UnsupportedFloat;
+		return DecodeError::None;
+	}
 
-		if (!strm.hasMore()) {
-			return makeItem(End{});
+	//
+	// Read the argument of the head `b`: a value, a length, or a tag. Indefinite lengths map to `kIndefiniteLength`.
+	// Returns false if the input ends first. This is the one bounds check per head.
+	//
+	template <class Stream>
+	inline bool tryReadArgument(Stream& strm, byte b, const InitialByte& head, uint64_t& arg) {
+		if (head.argWidth) {
+			if (!strm.hasMore(head.argWidth)) return false;
+			arg = strm.nextArgument(head.argWidth);
+		} else {
+			arg = head.indefinite ? kIndefiniteLength : (b & 0b11111);
 		}
-		auto depth = stack.back().depth;
-		auto seq = stack.back().sequenceIdx;
-		auto len = stack.back().len;
-		// printf(" - NEXT (d %d|%ld) (s %ld / %ld)\n", depth, stack.size(), seq, len);
-
-        byte b              = strm.nextByte();
-        byte majorType      = b >> 5;
-        byte additionalInfo = b & 0b11111;
-        cborPrintf(" - parse_item() [stackDepth: %d] [curState: %s] [m %d | addInfo %d]\n", stack.size(),
-               stack.back().mode == Mode::array ? "array"
-               : stack.back().mode == Mode::map ? "map"
-                                                     : "root",
-               majorType, additionalInfo);
-
-        auto get_uint_for_length = [this](uint8_t additionalInfo) {
-            if (additionalInfo < 24) {
-                return (size_t)additionalInfo;
-            } else if (additionalInfo >= 24 and additionalInfo <= 27) {
-                size_t v;
-                if (additionalInfo == 24)
-                    v = (strm.template nextValue<uint8_t>());
-                else if (additionalInfo == 25)
-                    v = ntohs(strm.template nextValue<uint16_t>());
-                else if (additionalInfo == 26)
-                    v = ntohl(strm.template nextValue<uint32_t>());
-                else if (additionalInfo == 27)
-                    v = ntohll(strm.template nextValue<uint64_t>());
-                return v;
-            } else if (additionalInfo >= 28 and additionalInfo <= 30) {
-                assert(false);
-            } else if (additionalInfo == 31) {
-                return kIndefiniteLength;
-            }
-            throw std::runtime_error("what.");
-        };
+		return true;
+	}
 
-        auto get_uint_for_value = [&](uint8_t additionalInfo) {
-            auto out = get_uint_for_length(additionalInfo);
-            assert(out != kIndefiniteLength && "invalid value with additionalInfo 31.");
-            return out;
-        };
+	//
+	// After a typed array tag: read the head of the byte string holding the elements and check the elements are all there.
+	//
+	template <class Stream>
+	inline DecodeError tryReadTypedArrayLength(Stream& strm, uint64_t& len) {
+		if (!strm.hasMore()) return DecodeError::Truncated;
+		byte b                  = strm.nextByte();
+		const InitialByte& head = kInitialByteTable[b];
+		if (head.cls != HeadClass::Bytes) return DecodeError::ExpectedByteString;
+		if (!tryReadArgument(strm, b, head, len) or !strm.hasMore(len)) return DecodeError::Truncated;
+		return DecodeError::None;
+	}
 
-        if (majorType == 0) {
-            // vtor.visit_uint(get_uint_for_value(additionalInfo));
-            uint64_t v = (get_uint_for_value(additionalInfo));
-			if (v < 256) return makeItem((uint8_t)v);
-			return makeItem(v);
-        }
-
-        else if (majorType == 1) {
-            // vtor.visit_uint(-1 - static_cast<int64_t>(get_uint_for_value(additionalInfo)));
-            int64_t v = (-1 - static_cast<int64_t>(get_uint_for_value(additionalInfo)));
-			return makeItem(v);
-        }
-		
-        else if (majorType == 2) {
-            size_t str_len = get_uint_for_length(additionalInfo);
-            if (str_len == kIndefiniteLength) {
-                throw std::runtime_error("Indefinite length strings are NOT supported by this decoder.");
-            }
-            // assert(str_len > 0);
-			auto db = strm.nextBytes(str_len);
-            return makeItem(ByteBuffer { std::move(db) });
-        }
-
-        else if (majorType == 3) {
-            size_t str_len = get_uint_for_length(additionalInfo);
-            if (str_len == kIndefiniteLength) {
-                throw std::runtime_error("Indefinite length strings are NOT supported by this decoder.");
-            }
-            // assert(str_len > 0);
-			auto db = strm.nextBytes(str_len);
-            // vtor.visit_text_string(TextStringView{head, str_len});
-            cborPrintf(" - Advance with text string view : \"%s\"\n", std::string{TextBuffer{DataBuffer{db.buf,db.len}}.asStringView()}.c_str());
-            return makeItem(TextBuffer { std::move(db) });
-        }
-
-        else if (majorType == 4) {
-            size_t len = get_uint_for_length(additionalInfo);
-            return makeItem(BeginArray { len });
-        }
-
-        else if (majorType == 5) {
-            size_t len = get_uint_for_length(additionalInfo);
-            return makeItem(BeginMap { len });
-        }
-
-        else if (majorType == 6) {
-
-            size_t tag = get_uint_for_value(additionalInfo);
-
-            // This is a typed array.
-            if (tag >= 0b010'00000 and tag <= 0b010'11111) {
-
-                // uint8_t taType = tag & 0b11111;
-                uint8_t floating = (tag & 0b10000) != 0;
-                uint8_t signing  = (tag & 0b01000) != 0;
-                uint8_t endian   = (tag & 0b00100) != 0;
-                uint8_t ll       = tag & 0b00011;
-                TypedArrayBuffer::Type type;
-                if (floating and ll == 0)
-					throw std::runtime_error("invalid typed array type");
-                else if (floating and ll == 0)
-					throw std::runtime_error("float16 not supported");
-                else if (floating and ll == 3)
-					throw std::runtime_error("float128 not supported");
-                else if (floating and ll == 1)
-                    type = TypedArrayBuffer::eFloat32;
-                else if (floating and ll == 2)
-                    type = TypedArrayBuffer::eFloat64;
-                else if (ll == 0 and !signing)
-                    type = TypedArrayBuffer::eUInt8;
-                else if (ll == 0 and signing)
-                    type = TypedArrayBuffer::eInt8;
-                else if (ll == 1 and !signing)
-                    type = TypedArrayBuffer::eUInt16;
-                else if (ll == 1 and signing)
-                    type = TypedArrayBuffer::eInt16;
-                else if (ll == 2 and !signing)
-                    type = TypedArrayBuffer::eUInt32;
-                else if (ll == 2 and signing)
-                    type = TypedArrayBuffer::eInt32;
-                else if (ll == 3 and !signing)
-                    type = TypedArrayBuffer::eUInt64;
-                else if (ll == 3 and signing)
-                    type = TypedArrayBuffer::eInt64;
-				else
-					throw std::runtime_error("invalid typed array type.");
-
-                byte byteStringHead = strm.nextByte();
-                if (byteStringHead >> 5 != 0b010) { throw std::runtime_error("while parsing typed array, expected byte string."); }
-                byte byteStringAdditionalInfo = byteStringHead & 0b11111;
-                size_t blen                   = get_uint_for_length(byteStringAdditionalInfo);
-
-				auto db = strm.nextBytes(blen);
-				TypedArrayBuffer tav(std::move(db), type, endian);
-                return makeItem(std::move(tav));
-            } else {
-				throw std::runtime_error("unsupported tag data encountered.");
-            }
-        }
-
-        else if (majorType == 7) {
-            if (additionalInfo == 20) {
-                return makeItem(false);
-			} else if (additionalInfo == 21) {
-                return makeItem(true);
-			} else if (additionalInfo == 22) {
-                return makeItem(Null{});
-			} else if (additionalInfo < 24) {
-                return makeItem(additionalInfo);
-            } else if (additionalInfo == 24) {
-                byte sval = strm.nextByte();
-                return makeItem(sval);
-            } else if (additionalInfo == 25) {
-                uint16_t v = strm.template nextValue<uint16_t>();
-				if (v == 0x00fc) {
-					return makeItem(static_cast<float>(-std::numeric_limits<float>::infinity()));
-				}
-				if (v == 0x007c) {
-					return makeItem(static_cast<float>(std::numeric_limits<float>::infinity()));
-				}
-				if (v == 0x007e) {
-					return makeItem(static_cast<float>(std::numeric_limits<float>::quiet_NaN()));
-				}
-				throw std::runtime_error("half floats are not supported.");
-            } else if (additionalInfo == 26) {
-                float v = strm.template nextValue<float>();
-				v = ntoh(v);
-                return makeItem(v);
-            } else if (additionalInfo == 27) {
-                double v = strm.template nextValue<double>();
-				v = ntoh(v);
-                return makeItem(v);
-            } else if (additionalInfo == 28 or additionalInfo == 29 or additionalInfo == 30) {
-				throw std::runtime_error("not supported");
-            } else if (additionalInfo == 31) {
-				/*
-                if (stack.back().mode == Mode::array) {
-					printf(" - end indef array\n");
-                    // vtor.visit_end_array();
-                    stack.pop_back();
-                    // advance();
-                    return makeItem(EndArray {});
-                } else if (stack.back().mode == Mode::map) {
-					printf(" - end indef map\n");
-                    // vtor.visit_end_map();
-                    stack.pop_back();
-                    // advance();
-                    return makeItem(EndMap {});
-                } else {
-                    assert(false && "expected indef length thing.");
-                }
-				*/
-				return makeItem(End{});
-            }
-            throw std::runtime_error("what.");
+	//
+	// Decode one item from the stream into `out`, without any bookkeeping about the containers it is in.
+	// A break byte is returned as `End`. The caller must make sure there is at least one byte left.
+	//
+	template <class Stream>
+	inline DecodeError tryReadItem(Stream& strm, Item& out) {
+
+        byte b                  = strm.nextByte();
+        const InitialByte& head = kInitialByteTable[b];
+        cborPrintf(" - parse_item() [m %d | addInfo %d]\n", head.majorType, b & 0b11111);
+
+		uint64_t arg;
+		if (!tryReadArgument(strm, b, head, arg)) return DecodeError::Truncated;
+
+		switch (head.cls) {
+
+			case HeadClass::Unsigned:
+				out = arg < 256 ? Item::fromByte((uint8_t)arg) : Item::fromUint(arg);
+				return DecodeError::None;
+
+			case HeadClass::Negative:
+				out = Item::fromInt(-1 - static_cast<int64_t>(arg));
+				return DecodeError::None;
+
+			case HeadClass::Bytes:
+				if (!strm.hasMore(arg)) return DecodeError::Truncated;
+				out = Item::fromData(ItemType::Bytes, strm.nextBytes(arg), arg);
+				return DecodeError::None;
+
+			case HeadClass::Text:
+				if (!strm.hasMore(arg)) return DecodeError::Truncated;
+				out = Item::fromData(ItemType::Text, strm.nextBytes(arg), arg);
+				cborPrintf(" - Advance with text string view : \"%s\"\n", std::string{(const char*)out.ptr, arg}.c_str());
+				return DecodeError::None;
+
+			case HeadClass::Array:
+				out = Item::fromBeginArray(arg);
+				return DecodeError::None;
+
+			case HeadClass::Map:
+				out = Item::fromBeginMap(arg);
+				return DecodeError::None;
+
+			case HeadClass::Tag: {
+				uint64_t tag = arg;
+
+				TypedArrayBuffer::Type type;
+				DecodeError e = tryTypedArrayTag(tag, type);
+				if (e != DecodeError::None) return e;
+
+				uint64_t blen;
+				e = tryReadTypedArrayLength(strm, blen);
+				if (e != DecodeError::None) return e;
+
+				out = Item::fromData(ItemType::TypedArray, strm.nextBytes(blen), blen);
+				out.taType = type;
+				out.taEndian = (tag & 0b00100) != 0;
+				return DecodeError::None;
+			}
+
+			case HeadClass::False: out = Item::fromBool(false); return DecodeError::None;
+			case HeadClass::True: out = Item::fromBool(true); return DecodeError::None;
+			case HeadClass::Null: out = Item::fromNull(); return DecodeError::None;
+			case HeadClass::Simple: out = Item::fromByte(static_cast<uint8_t>(arg)); return DecodeError::None;
+
+			case HeadClass::Float16:
+				if (arg == 0xfc00) out = Item::fromFloat(-std::numeric_limits<float>::infinity());
+				else if (arg == 0x7c00) out = Item::fromFloat(std::numeric_limits<float>::infinity());
+				else if (arg == 0x7e00) out = Item::fromFloat(std::numeric_limits<float>::quiet_NaN());
+				else return DecodeError::UnsupportedFloat;
+				return DecodeError::None;
+
+			case HeadClass::Float32: {
+				uint32_t bits = static_cast<uint32_t>(arg);
+				float v;
+				memcpy(&v, &bits, sizeof(v));
+				out = Item::fromFloat(v);
+				return DecodeError::None;
+			}
+
+			case HeadClass::Float64: {
+				double v;
+				memcpy(&v, &arg, sizeof(v));
+				out = Item::fromDouble(v);
+				return DecodeError::None;
+			}
+
+			case HeadClass::Break:
+				out = Item::fromEnd();
+				return DecodeError::None;
+
+			case HeadClass::Reserved:
+				return head.indefinite ? DecodeError::IndefiniteString : DecodeError::Reserved;
+		}
+
+		return DecodeError::Reserved;
+	}
+
+	template <class Stream>
+	inline Item readItem(Stream& strm) {
+		Item it;
+		DecodeError e = tryReadItem(strm, it);
+		if (e != DecodeError::None) throw std::runtime_error(toString(e));
+		return it;
+	}
+
+	template <class Stream, size_t MaxDepth>
+	inline DecodeStatus BasicCborParser<Stream, MaxDepth>::tryNext(Item& out) {
+
+		size_t offset = strm.pos();
+		if (!strm.hasMore()) {
+			out = Item::fromEnd();
+			if (depth_ > 0) return DecodeStatus { DecodeError::Truncated, offset };
+			return DecodeStatus {};
 		}
 
-		throw std::runtime_error("impossible");
+		DecodeError e = tryReadItem(strm, out);
+		if (e != DecodeError::None) return DecodeStatus { e, offset };
+
+		switch (out.type) {
+			case ItemType::BeginArray:
+			case ItemType::BeginMap:
+				if (depth_ == MaxDepth) return DecodeStatus { DecodeError::NestingTooDeep, offset };
+				if (out.type == ItemType::BeginArray) makeContainerItem(out, Mode::array, out.size);
+				else makeContainerItem(out, Mode::map, out.size == kIndefiniteLength ? out.size : 2 * out.size);
+				break;
+			case ItemType::End:
+				if (depth_ == 0 or stack_[depth_].len != kIndefiniteLength) return DecodeStatus { DecodeError::UnexpectedBreak, offset };
+				makeBreakItem();
+				break;
+			default:
+				advance();
+		}
+		return DecodeStatus {};
 	}
 
+	template <class Stream, size_t MaxDepth>
+	inline Item BasicCborParser<Stream, MaxDepth>::next() {
+		Item it;
+		DecodeStatus status = tryNext(it);
+		if (!status) throw std::runtime_error(status.message());
+		return it;
+	}
+
+	template <class Stream, size_t MaxDepth>
 	template <class F>
-	inline void CborParser::consumeMap(size_t size, F&& f) {
+	inline void BasicCborParser<Stream, MaxDepth>::consumeMap(size_t size, F&& f) {
 		// printf(" - begin map %d\n", (int)size);
 		for (size_t i=0; i<size; i++) {
-			auto key { this->next() };
-			// if (std::holds_alternative<EndMap>(key.value)) break;
-			if (std::holds_alternative<End>(key.value)) break;
+			Item key = this->next();
+			if (key.is<End>()) break;
 
-			auto val { this->next() };
+			Item val = this->next();
 
-			using ReturnType = std::invoke_result_t<F, Item&&, Item&&>;
+			using ReturnType = std::invoke_result_t<F, Item, Item>;
 			if constexpr (std::is_same_v<ReturnType, bool>) {
-				bool keepGoing = f(std::move(key), std::move(val));
+				bool keepGoing = f(key, val);
 				if (!keepGoing) break;
 			} else {
-				f(std::move(key), std::move(val));
+				f(key, val);
 			}
 		}
 		// f(makeItem(EndMap{}),makeItem(EndMap{}));
 	}
 
+	template <class Stream, size_t MaxDepth>
 	template <class F>
-	inline void CborParser::consumeArray(size_t size, F&& f) {
+	inline void BasicCborParser<Stream, MaxDepth>::consumeArray(size_t size, F&& f) {
 		for (size_t i=0; i<size; i++) {
 
-			auto val { this->next() };
-			// if (std::holds_alternative<EndArray>(val.value)) break;
-			if (std::holds_alternative<End>(val.value)) break;
-			f(std::move(val));
+			Item val = this->next();
+			if (val.is<End>()) break;
+			f(val);
 		}
 		// f(makeItem(EndArray{}));
 	}
 
 
+	//
+	// Skip `count` items, or up to and including a break byte if `count` is `kIndefiniteLength`.
+	// Containers are skipped by counting heads; nothing is decoded.
+	//
+	template <size_t MaxDepth, class Stream>
+	inline DecodeError trySkipItems(Stream& strm, size_t count) {
+		// Items left to skip in each open container (`kIndefiniteLength` means: until a break byte).
+		size_t remaining[MaxDepth + 1];
+		size_t n = 0;
+		remaining[n++] = count;
+
+		while (n > 0) {
+			if (remaining[n - 1] == 0) {
+				n--;
+				continue;
+			}
+			if (!strm.hasMore()) return DecodeError::Truncated;
+
+			byte b                  = strm.nextByte();
+			const InitialByte& head = kInitialByteTable[b];
+
+			if (head.cls == HeadClass::Break) {
+				if (remaining[n - 1] != kIndefiniteLength) return DecodeError::UnexpectedBreak;
+				n--;
+				continue;
+			}
+			if (remaining[n - 1] != kIndefiniteLength) remaining[n - 1]--;
+
+			uint64_t arg;
+			if (!tryReadArgument(strm, b, head, arg)) return DecodeError::Truncated;
+
+			switch (head.cls) {
+				case HeadClass::Bytes:
+				case HeadClass::Text:
+					if (!strm.hasMore(arg)) return DecodeError::Truncated;
+					strm.skip(arg);
+					break;
+
+				case HeadClass::Array:
+				case HeadClass::Map:
+					if (n == MaxDepth + 1) return DecodeError::NestingTooDeep;
+					remaining[n++] = (arg == kIndefiniteLength or head.cls == HeadClass::Array) ? arg : 2 * arg;
+					break;
+
+				case HeadClass::Tag: {
+					TypedArrayBuffer::Type type;
+					DecodeError e = tryTypedArrayTag(arg, type);
+					if (e != DecodeError::None) return e;
+					uint64_t blen;
+					e = tryReadTypedArrayLength(strm, blen);
+					if (e != DecodeError::None) return e;
+					strm.skip(blen);
+					break;
+				}
+
+				case HeadClass::Reserved:
+					return head.indefinite ? DecodeError::IndefiniteString : DecodeError::Reserved;
+
+				default:
+					// Scalars: the argument was all there was.
+					break;
+			}
+		}
+		return DecodeError::None;
+	}
+
+	template <size_t MaxDepth, class Stream>
+	inline void skipItems(Stream& strm, size_t count) {
+		DecodeError e = trySkipItems<MaxDepth>(strm, count);
+		if (e != DecodeError::None) throw std::runtime_error(toString(e));
+	}
+
+	template <class Stream, size_t MaxDepth>
+	inline DecodeStatus BasicCborParser<Stream, MaxDepth>::trySkipValue() {
+		size_t offset = strm.pos();
+		if (!strm.hasMore()) {
+			// As with `tryNext`: the end of the input is only fine outside of any container.
+			if (depth_ > 0) return DecodeStatus { DecodeError::Truncated, offset };
+			return DecodeStatus {};
+		}
+		DecodeError e = trySkipItems<MaxDepth>(strm, 1);
+		if (e != DecodeError::None) return DecodeStatus { e, offset };
+		advance();
+		return DecodeStatus {};
+	}
+
+	template <class Stream, size_t MaxDepth>
+	inline void BasicCborParser<Stream, MaxDepth>::skipValue() {
+		DecodeStatus status = trySkipValue();
+		if (!status) throw std::runtime_error(status.message());
+	}
+
+	template <class Stream, size_t MaxDepth>
+	inline void BasicCborParser<Stream, MaxDepth>::skipRemaining() {
+		if (depth_ == 0) {
+			while (strm.hasMore()) skipValue();
+			return;
+		}
+
+		const State& s = stack_[depth_];
+		skipItems<MaxDepth>(strm, s.len == kIndefiniteLength ? kIndefiniteLength : s.len - s.sequenceIdx);
+		depth_--;
+		popFinished();
+	}
+
+	template <class Stream, size_t MaxDepth>
+	inline void BasicCborParser<Stream, MaxDepth>::skipRemaining(const Item& begin) {
+		assert(begin.type == ItemType::BeginArray or begin.type == ItemType::BeginMap);
+		if (begin.size != 0) skipRemaining();
+	}
+
 }
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "cbor_parser.hpp"
+
+//
+// A push ("SAX") parser.
+//
+// Derive a handler from `SaxHandler<YourHandler>` and define only the callbacks you need; the base supplies no-op
+// defaults for the others. Calls are resolved statically, so the whole decode loop is instantiated for (and can be
+// inlined into) your handler, with no `Item` in between.
+//
+//     struct CountTexts : SaxHandler<CountTexts> {
+//         int n = 0;
+//         void on_text(std::string_view) { n++; }
+//     };
+//     CountTexts h;
+//     h.parse(data, len);
+//
+// `on_begin_map` / `on_begin_array` get the element (pair) count, or `kIndefiniteLength`. They may return `bool`:
+// `false` skips the container's contents without emitting anything for them, nor the matching end.
+// Any other callback may also return `bool`, where `false` stops parsing.
+//
+// Simple values other than `true`, `false` and `null` are reported with `on_simple`. Small unsigned integers are
+// reported with `on_uint`, unlike `Item` which distinguishes `Byte`.
+//
+
+namespace cbor {
+
+	template <class Derived>
+	struct SaxHandler {
+
+		inline void on_uint(uint64_t) {}
+		inline void on_int(int64_t) {}
+		inline void on_float(float) {}
+		inline void on_double(double) {}
+		inline void on_bool(bool) {}
+		inline void on_null() {}
+		inline void on_simple(uint8_t) {}
+		inline void on_text(std::string_view) {}
+		inline void on_bytes(const byte*, size_t) {}
+		inline void on_typed_array(TypedArrayBuffer::Type, bool /*littleEndian*/, const byte*, size_t) {}
+		inline void on_begin_map(size_t) {}
+		inline void on_end_map() {}
+		inline void on_begin_array(size_t) {}
+		inline void on_end_array() {}
+
+		// Parse every item in the stream. Returns false if a callback stopped it early.
+		template <size_t MaxDepth = kDefaultMaxDepth, class Stream>
+		bool parse(Stream& strm);
+
+		inline bool parse(const byte* data, size_t len) {
+			BinStreamBuffer strm(data, len);
+			return parse(strm);
+		}
+
+		private:
+
+		inline Derived& derived() { return static_cast<Derived&>(*this); }
+
+	};
+
+	namespace {
+		// Evaluate a callback, treating `void` as "keep going".
+		template <class F>
+		inline bool saxCall(F&& f) {
+			if constexpr (std::is_same_v<std::invoke_result_t<F>, bool>) {
+				return f();
+			} else {
+				f();
+				return true;
+			}
+		}
+	}
+
+	template <class Derived>
+	template <size_t MaxDepth, class Stream>
+	inline bool SaxHandler<Derived>::parse(Stream& strm) {
+		Derived& h = derived();
+
+		// Open containers: items left (`kIndefiniteLength` means: until a break byte), and whether it is a map.
+		size_t remaining[MaxDepth + 1];
+		bool isMap[MaxDepth + 1];
+		size_t n = 0;
+
+		auto close = [&]() {
+			n--;
+			return isMap[n] ? saxCall([&] { return h.on_end_map(); }) : saxCall([&] { return h.on_end_array(); });
+		};
+
+		while (true) {
+			if (n > 0 and remaining[n - 1] == 0) {
+				if (!close()) return false;
+				continue;
+			}
+			if (!strm.hasMore()) {
+				if (n > 0) throw std::runtime_error("cbor: input ended inside a container.");
+				return true;
+			}
+
+			byte b                  = strm.nextByte();
+			const InitialByte& head = kInitialByteTable[b];
+
+			if (head.cls == HeadClass::Break) {
+				if (n == 0 or remaining[n - 1] != kIndefiniteLength) throw std::runtime_error("cbor: unexpected break byte.");
+				if (!close()) return false;
+				continue;
+			}
+			if (n > 0 and remaining[n - 1] != kIndefiniteLength) remaining[n - 1]--;
+
+			uint64_t arg;
+			if (!tryReadArgument(strm, b, head, arg)) throw std::runtime_error(toString(DecodeError::Truncated));
+
+			bool keepGoing = true;
+			switch (head.cls) {
+
+				case HeadClass::Unsigned:
+					keepGoing = saxCall([&] { return h.on_uint(arg); });
+					break;
+
+				case HeadClass::Negative:
+					keepGoing = saxCall([&] { return h.on_int(-1 - static_cast<int64_t>(arg)); });
+					break;
+
+				case HeadClass::Bytes: {
+					if (!strm.hasMore(arg)) throw std::runtime_error(toString(DecodeError::Truncated));
+					auto ptr = strm.nextBytes(arg);
+					keepGoing = saxCall([&] { return h.on_bytes(ptr, arg); });
+					break;
+				}
+
+				case HeadClass::Text: {
+					if (!strm.hasMore(arg)) throw std::runtime_error(toString(DecodeError::Truncated));
+					auto ptr = strm.nextBytes(arg);
+					keepGoing = saxCall([&] { return h.on_text(std::string_view { reinterpret_cast<const char*>(ptr), arg }); });
+					break;
+				}
+
+				case HeadClass::Array:
+				case HeadClass::Map: {
+					bool map = head.cls == HeadClass::Map;
+					size_t items = (arg == kIndefiniteLength or !map) ? arg : 2 * arg;
+
+					bool descend;
+					if (map) {
+						if constexpr (std::is_same_v<decltype(h.on_begin_map(arg)), bool>) descend = h.on_begin_map(arg);
+						else h.on_begin_map(arg), descend = true;
+					} else {
+						if constexpr (std::is_same_v<decltype(h.on_begin_array(arg)), bool>) descend = h.on_begin_array(arg);
+						else h.on_begin_array(arg), descend = true;
+					}
+
+					if (!descend) {
+						skipItems<MaxDepth>(strm, items);
+					} else {
+						if (n == MaxDepth) throw std::runtime_error("cbor: maximum nesting depth exceeded.");
+						remaining[n] = items;
+						isMap[n]     = map;
+						n++;
+					}
+					break;
+				}
+
+				case HeadClass::Tag: {
+					TypedArrayBuffer::Type type;
+					DecodeError e = tryTypedArrayTag(arg, type);
+					if (e != DecodeError::None) throw std::runtime_error(toString(e));
+					bool littleEndian = (arg & 0b00100) != 0;
+
+					uint64_t blen;
+					e = tryReadTypedArrayLength(strm, blen);
+					if (e != DecodeError::None) throw std::runtime_error(toString(e));
+
+					auto ptr = strm.nextBytes(blen);
+					keepGoing = saxCall([&] { return h.on_typed_array(type, littleEndian, ptr, blen); });
+					break;
+				}
+
+				case HeadClass::False: keepGoing = saxCall([&] { return h.on_bool(false); }); break;
+				case HeadClass::True: keepGoing = saxCall([&] { return h.on_bool(true); }); break;
+				case HeadClass::Null: keepGoing = saxCall([&] { return h.on_null(); }); break;
+				case HeadClass::Simple: keepGoing = saxCall([&] { return h.on_simple(static_cast<uint8_t>(arg)); }); break;
+
+				case HeadClass::Float16: {
+					float v;
+					if (arg == 0xfc00) v = -std::numeric_limits<float>::infinity();
+					else if (arg == 0x7c00) v = std::numeric_limits<float>::infinity();
+					else if (arg == 0x7e00) v = std::numeric_limits<float>::quiet_NaN();
+					else throw std::runtime_error("half floats are not supported.");
+					keepGoing = saxCall([&] { return h.on_float(v); });
+					break;
+				}
+
+				case HeadClass::Float32: {
+					uint32_t bits = static_cast<uint32_t>(arg);
+					float v;
+					memcpy(&v, &bits, sizeof(v));
+					keepGoing = saxCall([&] { return h.on_float(v); });
+					break;
+				}
+
+				case HeadClass::Float64: {
+					double v;
+					memcpy(&v, &arg, sizeof(v));
+					keepGoing = saxCall([&] { return h.on_double(v); });
+					break;
+				}
+
+				case HeadClass::Break: break;
+
+				case HeadClass::Reserved:
+					if (head.indefinite) throw std::runtime_error("Indefinite length strings are NOT supported by this decoder.");
+					throw std::runtime_error("not supported");
+			}
+
+			if (!keepGoing) return false;
+		}
+	}
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "cbor_parser.hpp"
+
+//
+// A structural index ("tape") over an encoded buffer.
+//
+// Stage one (`buildTape`) does a single linear pass over the encoding, counting heads only, and records one compact
+// entry per item: where its head is, what kind of item it is, and the index of the entry following its subtree.
+// Stage two is whatever the consumer does with it: jump to a sibling in O(1), learn the size of an indefinite-length
+// container before reserving for it, or decode only the entries it cares about with `Tape::item()`.
+//
+// Break bytes do not get entries. The tape refers to, but does not own, the input buffer.
+//
+
+namespace cbor {
+
+	struct TapeEntry {
+		uint64_t offset : 56; // Byte offset of the item's head in the input
+		uint64_t type : 8;    // `ItemType`
+		uint32_t next;        // Index of the entry after this item and all of its children
+		uint32_t count;       // Containers: elements (arrays) or pairs (maps), also for indefinite-length ones
+
+		inline ItemType itemType() const { return static_cast<ItemType>(type); }
+		inline bool isContainer() const { return itemType() == ItemType::BeginArray or itemType() == ItemType::BeginMap; }
+	};
+
+	static_assert(sizeof(TapeEntry) == 16);
+
+	struct Tape {
+		const byte* data = nullptr;
+		size_t len = 0;
+		std::vector<TapeEntry> entries;
+
+		inline size_t size() const { return entries.size(); }
+		inline const TapeEntry& operator[](size_t i) const { return entries[i]; }
+
+		// The first child of a container is always the next entry. Its siblings follow via `nextSibling`.
+		inline size_t firstChild(size_t i) const { return i + 1; }
+		inline size_t nextSibling(size_t i) const { return entries[i].next; }
+
+		// Decode entry `i`. Containers get their element (or pair) count, even if they were encoded with indefinite length.
+		inline Item item(size_t i) const {
+			BinStreamBuffer strm(data, len);
+			strm.cursor_ = entries[i].offset;
+			Item it = readItem(strm);
+			if (entries[i].isContainer()) it.size = entries[i].count;
+			return it;
+		}
+	};
+
+	inline Tape buildTape(const byte* data, size_t len, size_t maxDepth = kDefaultMaxDepth) {
+		Tape tape;
+		tape.data = data;
+		tape.len = len;
+		// A rough first guess of one entry per 16 input bytes (an entry is 16 bytes itself, so this reserves about the
+		// input's size). Inputs with many tiny items grow from there geometrically.
+		tape.entries.reserve(len / 16);
+
+		// Open containers: entry index, and items left (`kIndefiniteLength` means: until a break byte).
+		struct Open {
+			uint32_t entry;
+			size_t remaining;
+		};
+		std::vector<Open> open;
+		open.reserve(maxDepth);
+
+		auto close = [&](const Open& o) {
+			auto& e = tape.entries[o.entry];
+			e.next = static_cast<uint32_t>(tape.entries.size());
+			if (e.itemType() == ItemType::BeginMap) e.count /= 2;
+		};
+
+		BinStreamBuffer strm(data, len);
+		while (strm.hasMore()) {
+			uint64_t offset         = strm.cursor();
+			byte b                  = strm.nextByte();
+			const InitialByte& head = kInitialByteTable[b];
+
+			if (head.cls == HeadClass::Break) {
+				if (open.empty() or open.back().remaining != kIndefiniteLength) throw std::runtime_error("cbor: unexpected break byte.");
+				close(open.back());
+				open.pop_back();
+			} else {
+
+				uint64_t arg;
+				if (!tryReadArgument(strm, b, head, arg)) throw std::runtime_error(toString(DecodeError::Truncated));
+
+				ItemType type;
+				switch (head.cls) {
+					case HeadClass::Unsigned: type = arg < 256 ? ItemType::Byte : ItemType::Uint64; break;
+					case HeadClass::Negative: type = ItemType::Int64; break;
+					case HeadClass::Bytes:
+					case HeadClass::Text:
+						if (!strm.hasMore(arg)) throw std::runtime_error(toString(DecodeError::Truncated));
+						type = head.cls == HeadClass::Bytes ? ItemType::Bytes : ItemType::Text;
+						strm.skip(arg);
+						break;
+					case HeadClass::Array: type = ItemType::BeginArray; break;
+					case HeadClass::Map: type = ItemType::BeginMap; break;
+					case HeadClass::Tag: {
+						TypedArrayBuffer::Type taType;
+						DecodeError e = tryTypedArrayTag(arg, taType);
+						if (e != DecodeError::None) throw std::runtime_error(toString(e));
+						uint64_t blen;
+						e = tryReadTypedArrayLength(strm, blen);
+						if (e != DecodeError::None) throw std::runtime_error(toString(e));
+						strm.skip(blen);
+						type = ItemType::TypedArray;
+						break;
+					}
+					case HeadClass::False:
+					case HeadClass::True: type = ItemType::Bool; break;
+					case HeadClass::Null: type = ItemType::Null; break;
+					case HeadClass::Simple: type = ItemType::Byte; break;
+					case HeadClass::Float16:
+					case HeadClass::Float32: type = ItemType::F32; break;
+					case HeadClass::Float64: type = ItemType::F64; break;
+					default: throw std::runtime_error("not supported");
+				}
+
+				// Count this item in its parent.
+				if (!open.empty()) {
+					auto& parent = open.back();
+					tape.entries[parent.entry].count++;
+					if (parent.remaining != kIndefiniteLength) parent.remaining--;
+				}
+
+				uint32_t index = static_cast<uint32_t>(tape.entries.size());
+				tape.entries.push_back(TapeEntry { offset, static_cast<uint64_t>(type), index + 1, 0 });
+
+				if (type == ItemType::BeginArray or type == ItemType::BeginMap) {
+					if (open.size() == maxDepth) throw std::runtime_error("cbor: maximum nesting depth exceeded.");
+					size_t items = (arg == kIndefiniteLength or type == ItemType::BeginArray) ? arg : 2 * arg;
+					open.push_back(Open { index, items });
+				}
+			}
+
+			// Close every definite container that is now complete.
+			while (!open.empty() and open.back().remaining == 0) {
+				close(open.back());
+				open.pop_back();
+			}
+		}
+
+		if (!open.empty()) throw std::runtime_error("cbor: input ended inside a container.");
+		return tape;
+	}
+
+}
@@ -2,23 +2,28 @@
 
 #include "cbor_parser.hpp"
 #include "cbor_encoder.hpp"
+#include "cbor_arena.hpp"
+
+#include <deque>
+#include <string>
+#include <unordered_map>
 
 //
 // An even higher level of abstraction.
 // We decode to a tree, from which the user can access items.
-// Buffers are not copied, but viewed.
+// Buffers are not copied, but viewed (unless the stream cannot keep them alive, see `kStableViews`).
+//
+// A `Node` is 24 bytes: a kind tag and a union of a scalar, a pointer to string bytes, or a pointer to an array of children
+// (`Node`s for a vec, `KeyValue`s for a map), plus the length. Children are allocated as one exactly sized array, so
+// traversing a container walks contiguous memory.
 //
-// FIXME: Now that this library will be used on binary buffers only (as opposed to files)
-//        I can now have the 3 DataBuffer subclasses be trivial, which would allow
-//        putting them in the Union as well.
-//        Then by implmenting a custom vector type, the `map` and `vec` fields could also
-//        go in the union.
-//        Reducing the size of the `Node` as much as possible will help with perf.
+// Pass an `Arena` to `parseTree` to have all children arrays and copied strings bump-allocated from it. Such a tree
+// does not own anything, is released all at once with the arena, and must not outlive it.
 //
 
 namespace cbor {
 
-	enum class Kind {
+	enum class Kind : uint8_t {
 		Invalid, Byte, Int64, Uint64, F32, F64, Boolean, Text, Bytes, TypedArray, Map, Vec, Null
 	};
 
@@ -32,21 +37,49 @@ namespace cbor {
 		bool boolean;
 	};
 
-	struct Node {
-		Union scalar;
+	// A contiguous range of children, as returned by `Node::items()` and `Node::pairs()`.
+	template <class T>
+	struct NodeRange {
+		T* first = nullptr;
+		size_t len = 0;
 
-		TextBuffer text;
-		ByteBuffer bytes;
-		TypedArrayBuffer tab;
+		inline T* begin() const { return first; }
+		inline T* end() const { return first + len; }
+		inline size_t size() const { return len; }
+		inline T& operator[](size_t i) const { assert(i < len); return first[i]; }
+	};
 
-		std::vector<Node> vec;
-		std::vector<std::pair<Node,Node>> map;
+	struct KeyValue;
 
+	// The id of an interned key (see `KeyInterner`), for lookups by integer compare.
+	struct KeyId {
+		uint32_t id;
+	};
+
+	struct Node {
+		union {
+			Union scalar;
+			const byte* ptr; // Text, Bytes, TypedArray
+			Node* elems;     // Vec
+			KeyValue* kvs;   // Map
+		};
+		uint64_t len = 0;      // Byte length (Text, Bytes, TypedArray) or number of elements (Vec) or pairs (Map)
 		Kind kind;
+		uint8_t taType : 4;    // `TypedArrayBuffer::Type` when `kind == TypedArray`
+		uint8_t taEndian : 1;  // 0 big, 1 little
+		uint8_t owned : 1;     // Did this node allocate `ptr` / `elems` / `kvs`?
+		uint8_t sorted : 1;    // Map pairs are ordered by key (see `buildIndex`)
+		uint32_t keyId = 0;    // Text map keys parsed with a `KeyInterner`: the key's id (0: not interned)
 
 
+		inline Node() : scalar({}), kind(Kind::Invalid), taType(0), taEndian(1), owned(0), sorted(0) {}
+		inline ~Node();
+
+		Node(const Node&) = delete;
+		Node& operator=(const Node&) = delete;
+		inline Node(Node&& o);
+		inline Node& operator=(Node&& o);
 
-		inline Node() : kind(Kind::Invalid), scalar({}) {}
 		inline static Node fromInt(int64_t x) {
 			Node out;
 			out.scalar.int64 = x;
@@ -83,46 +116,42 @@ namespace cbor {
 			out.kind = Kind::Boolean;
 			return out;
 		}
-		inline static Node fromMap(std::vector<std::pair<Node,Node>>&& map) {
-			Node out;
-			out.map = std::move(map);
-			out.kind = Kind::Map;
-			return out;
-		}
-		inline static Node fromVec(std::vector<Node>&& vec) {
+		inline static Node fromMap(std::vector<std::pair<Node,Node>>&& map, Arena* arena = nullptr);
+		inline static Node fromVec(std::vector<Node>&& vec, Arena* arena = nullptr);
+
+		// Text, Bytes or TypedArray. A view of `data` unless `copy`, in which case the copy is made in `arena` if given.
+		inline static Node fromData(Kind kind, const uint8_t* data, size_t len, bool copy, Arena* arena = nullptr) {
 			Node out;
-			out.vec = std::move(vec);
-			out.kind = Kind::Vec;
+			out.kind = kind;
+			out.len = len;
+			if (copy and arena) {
+				out.ptr = arena->copy(data, len);
+			} else if (copy) {
+				byte* buf = new byte[len];
+				memcpy(buf, data, len);
+				out.ptr = buf;
+				out.owned = true;
+			} else {
+				out.ptr = data;
+			}
 			return out;
 		}
 		inline static Node fromText(std::string_view s) {
-			Node out;
-			out.text = TextBuffer{s};
-			out.kind = Kind::Text;
-			return out;
+			return fromData(Kind::Text, (const uint8_t*)s.data(), s.length(), false);
 		}
 		inline static Node fromTextBuffer(TextBuffer&& tb) {
-			Node out;
-			out.text = std::move(tb);
-			out.kind = Kind::Text;
-			return out;
+			return adopt(Kind::Text, tb);
 		}
 		inline static Node fromBytes(const uint8_t* data, size_t len) {
-			Node out;
-			out.bytes = std::move(ByteBuffer{data,len});
-			out.kind = Kind::Bytes;
-			return out;
+			return fromData(Kind::Bytes, data, len, false);
 		}
 		inline static Node fromBytes(ByteBuffer&& bb) {
-			Node out;
-			out.bytes = std::move(bb);
-			out.kind = Kind::Bytes;
-			return out;
+			return adopt(Kind::Bytes, bb);
 		}
 		inline static Node fromTypedArray(TypedArrayBuffer&& tab) {
-			Node out;
-			out.tab = std::move(tab);
-			out.kind = Kind::TypedArray;
+			Node out = adopt(Kind::TypedArray, tab);
+			out.taType = tab.type;
+			out.taEndian = tab.endianness;
 			return out;
 		}
 		inline static Node fromNull() {
@@ -131,18 +160,28 @@ namespace cbor {
 			return out;
 		}
 
+		// A vec or map of `n` default (invalid) children, to be filled in place. Allocated in `arena` if given.
+		inline static Node allocVec(size_t n, Arena* arena = nullptr);
+		inline static Node allocMap(size_t n, Arena* arena = nullptr);
+
 
 
 		inline bool isInvalid() const { return kind == Kind::Invalid; }
 		inline bool isMap() const { return kind == Kind::Map; }
 		inline bool isVec() const { return kind == Kind::Vec; }
 		inline bool isText() const { return kind == Kind::Text; }
+		inline bool isBytes() const { return kind == Kind::Bytes; }
 		inline bool isTypedArray() const { return kind == Kind::TypedArray; }
 		inline bool isNull() const { return kind == Kind::Null; }
 
-		inline const TypedArrayBuffer& asTypedArray() const {
+		// These return views of the node's bytes.
+		inline TypedArrayBuffer asTypedArray() const {
 			assert(isTypedArray());
-			return tab;
+			return TypedArrayBuffer(DataBuffer(ptr, len), static_cast<TypedArrayBuffer::Type>(taType), taEndian);
+		}
+		inline ByteBuffer asBytes() const {
+			assert(isBytes());
+			return ByteBuffer(ptr, len);
 		}
 
 		inline int64_t asInt() const {
@@ -205,235 +244,811 @@ namespace cbor {
 		}
 		inline std::string_view asStringView() const {
 			assert(isText());
-			return text.asStringView();
+			return std::string_view((const char*)ptr, len);
 		}
 
 		inline size_t size() const {
 			assert(isMap() or isVec());
-			return isMap() ? map.size() : vec.size();
+			return len;
 		}
 
-		inline const Node& operator[](size_t i) const {
-			if (isVec()) {
-				assert(i < vec.size());
-				return vec[i];
-			}
-			if (isMap()) {
-				assert(false && "todo: indexing a map with an integer is not supported yet. You may use `getNthKeyValue` though.");
-			}
-			throw std::runtime_error("can only index a Node with an integer if it is a map or vec");
+		inline NodeRange<const Node> items() const {
+			assert(isVec());
+			return NodeRange<const Node> { elems, len };
+		}
+		inline NodeRange<const KeyValue> pairs() const {
+			assert(isMap());
+			return NodeRange<const KeyValue> { kvs, len };
 		}
 
+		// Vec: the `i`th element. Map: the value of integer key `i`.
+		inline const Node& operator[](size_t i) const;
+
 		// TODO: Allow matching against a Node, not just a strview
-		inline const Node& operator[](std::string_view key) const {
-			assert(isMap());
-			for (uint32_t i=0; i<map.size(); i++) {
-				assert(map[i].first.isText());
-				if (map[i].first.text.asStringView() == key) return map[i].second;
-			}
-			throw std::runtime_error("cbor::Node::operator[] missing key: " + std::string(key));
+		inline const Node& operator[](std::string_view key) const;
+
+		// The key-value pair with text key `key` (or integer key `key`), or nullptr.
+		// This is a linear scan, unless `buildIndex()` was called, in which case it is a binary search.
+		inline const KeyValue* find(std::string_view key) const;
+		inline const KeyValue* find(int64_t key) const;
+
+		// The pair with interned key `key`. Only keys parsed with the same `KeyInterner` can match.
+		inline const KeyValue* find(KeyId key) const;
+		inline const Node& operator[](KeyId key) const;
+
+		inline bool has(std::string_view key) const {
+			return find(key) != nullptr;
+		}
+		inline bool has(int64_t key) const {
+			return find(key) != nullptr;
 		}
 
-		/*
-		inline size_t find(std::string_view key) const {
-			assert(isMap());
-			for (uint32_t i=0; i<map.size(); i++) {
-				assert(map[i].first.isText());
-				if (map[i].first.text.asStringView() == key) return i;
-			}
-			return kInvalidLength;
+		//
+		// Opt-in lookup index for maps: sorts the pairs by key *in place* (integers, then text, then anything else),
+		// so `find` and `operator[]` can binary search. Iteration and re-encoding then follow the sorted order.
+		// With `recursive`, every map below this node is indexed too. Has no effect on other kinds.
+		//
+		inline void buildIndex(bool recursive = false);
+
+		private:
+
+		// Take over the bytes of a buffer: owned buffers are handed over, views stay views.
+		inline static Node adopt(Kind kind, DataBuffer& b) {
+			Node out;
+			out.kind = kind;
+			out.ptr = b.buf;
+			out.len = b.len;
+			out.owned = !b.isView;
+			b.isView = true;
+			return out;
 		}
 
-		inline bool has(std::string_view key) const {
-			return find(key) != kInvalidLength;
+		inline void release();
+
+	};
+
+	struct KeyValue {
+		Node first;
+		Node second;
+	};
+
+	static_assert(sizeof(Node) == 24);
+
+	inline Node::~Node() {
+		release();
+	}
+
+	inline void Node::release() {
+		if (owned) {
+			if (kind == Kind::Vec) delete[] elems;
+			else if (kind == Kind::Map) delete[] kvs;
+			else delete[] ptr;
+		}
+		owned = false;
+	}
+
+	inline Node::Node(Node&& o) : scalar(o.scalar), len(o.len), kind(o.kind), taType(o.taType), taEndian(o.taEndian), owned(o.owned), sorted(o.sorted), keyId(o.keyId) {
+		o.kind = Kind::Invalid;
+		o.owned = false;
+		o.len = 0;
+	}
+
+	inline Node& Node::operator=(Node&& o) {
+		if (this != &o) {
+			release();
+			scalar   = o.scalar;
+			len      = o.len;
+			kind     = o.kind;
+			taType   = o.taType;
+			taEndian = o.taEndian;
+			owned    = o.owned;
+			sorted   = o.sorted;
+			keyId    = o.keyId;
+			o.kind   = Kind::Invalid;
+			o.owned  = false;
+			o.len    = 0;
 		}
+		return *this;
+	}
 
-		inline const std::pair<Node,Node>& getNthKeyValue(size_t i) const {
-			assert(isMap());
-			assert(i >= 0 and i < map.size());
-			return map[i];
+	inline Node Node::allocVec(size_t n, Arena* arena) {
+		Node out;
+		out.kind = Kind::Vec;
+		out.len = n;
+		if (arena) {
+			out.elems = arena->make<Node>(n);
+		} else {
+			out.elems = n ? new Node[n] : nullptr;
+			out.owned = n > 0;
 		}
-		*/
+		return out;
+	}
 
-		inline decltype(map)::const_iterator find(std::string_view key) const {
-			assert(isMap());
-			for (uint32_t i=0; i<map.size(); i++) {
-				assert(map[i].first.isText());
-				if (map[i].first.text.asStringView() == key) return map.begin() + i;
-			}
-			return map.end();
+	inline Node Node::allocMap(size_t n, Arena* arena) {
+		Node out;
+		out.kind = Kind::Map;
+		out.len = n;
+		if (arena) {
+			out.kvs = arena->make<KeyValue>(n);
+		} else {
+			out.kvs = n ? new KeyValue[n] : nullptr;
+			out.owned = n > 0;
 		}
+		return out;
+	}
 
-		inline bool has(std::string_view key) const {
-			return find(key) != map.end();
+	inline Node Node::fromMap(std::vector<std::pair<Node,Node>>&& map, Arena* arena) {
+		Node out = allocMap(map.size(), arena);
+		for (size_t i=0; i<map.size(); i++) {
+			out.kvs[i].first = std::move(map[i].first);
+			out.kvs[i].second = std::move(map[i].second);
 		}
+		return out;
+	}
 
+	inline Node Node::fromVec(std::vector<Node>&& vec, Arena* arena) {
+		Node out = allocVec(vec.size(), arena);
+		for (size_t i=0; i<vec.size(); i++) out.elems[i] = std::move(vec[i]);
+		return out;
+	}
 
-	};
+	namespace {
+		// How map keys are ordered by `Node::buildIndex`: negative integers, non-negative integers, text, anything else.
+		struct KeyOrder {
+			enum Class : uint8_t { Negative, Unsigned, Text, Other } cls;
+			uint64_t u = 0; // Integers, as two's complement for negative ones (so unsigned order matches within a class)
+			std::string_view s;
 
+			inline explicit KeyOrder(const Node& k) {
+				switch (k.kind) {
+					case Kind::Byte: cls = Unsigned; u = k.scalar.byte; break;
+					case Kind::Uint64: cls = Unsigned; u = k.scalar.uint64; break;
+					case Kind::Int64: cls = k.scalar.int64 < 0 ? Negative : Unsigned; u = static_cast<uint64_t>(k.scalar.int64); break;
+					case Kind::Text: cls = Text; s = k.asStringView(); break;
+					default: cls = Other;
+				}
+			}
+			inline explicit KeyOrder(int64_t i) : cls(i < 0 ? Negative : Unsigned), u(static_cast<uint64_t>(i)) {}
+			inline explicit KeyOrder(std::string_view s) : cls(Text), s(s) {}
 
-	Node parseMap(CborParser& p, BeginMap&& begin);
-	Node parseArray(CborParser& p, BeginArray&& begin);
-	inline Node parseOne(CborParser& p, Item&& v) {
-		/*
-		Node out;
-		if (v.is<uint8_t>()) {
-			out.kind = Kind::Byte;
-			out.scalar.byte = v.expect<uint8_t>();
-			return out;
+			inline bool operator<(const KeyOrder& o) const {
+				if (cls != o.cls) return cls < o.cls;
+				if (cls == Text) return s < o.s;
+				return u < o.u;
+			}
+			inline bool operator==(const KeyOrder& o) const {
+				return cls == o.cls and cls != Other and u == o.u and s == o.s;
+			}
+		};
+
+		inline const KeyValue* findKey(const KeyValue* kvs, size_t len, bool sorted, const KeyOrder& key) {
+			if (sorted) {
+				const KeyValue* it = std::lower_bound(kvs, kvs + len, key, [](const KeyValue& kv, const KeyOrder& k) {
+					return KeyOrder(kv.first) < k;
+				});
+				return (it != kvs + len and KeyOrder(it->first) == key) ? it : nullptr;
+			}
+			for (size_t i=0; i<len; i++) {
+				if (KeyOrder(kvs[i].first) == key) return kvs + i;
+			}
+			return nullptr;
 		}
-		if (v.is<int64_t>()) {
-			out.kind = Kind::Int64;
-			out.scalar.int64 = v.expect<int64_t>();
-			return out;
+	}
+
+	inline const KeyValue* Node::find(std::string_view key) const {
+		assert(isMap());
+		return findKey(kvs, len, sorted, KeyOrder(key));
+	}
+
+	inline const KeyValue* Node::find(int64_t key) const {
+		assert(isMap());
+		return findKey(kvs, len, sorted, KeyOrder(key));
+	}
+
+	inline const KeyValue* Node::find(KeyId key) const {
+		assert(isMap());
+		for (size_t i=0; i<len; i++) {
+			if (kvs[i].first.keyId == key.id) return kvs + i;
 		}
-		if (v.is<uint64_t>()) {
-			out.kind = Kind::Uint64;
-			out.scalar.uint64 = v.expect<uint64_t>();
-			return out;
+		return nullptr;
+	}
+
+	inline const Node& Node::operator[](KeyId key) const {
+		const KeyValue* kv = find(key);
+		if (kv) return kv->second;
+		throw std::runtime_error("cbor::Node::operator[] missing interned key: " + std::to_string(key.id));
+	}
+
+	inline void Node::buildIndex(bool recursive) {
+		if (isMap() and !sorted) {
+			std::stable_sort(kvs, kvs + len, [](const KeyValue& a, const KeyValue& b) {
+				return KeyOrder(a.first) < KeyOrder(b.first);
+			});
+			sorted = 1;
 		}
-		if (v.is<float>()) {
-			out.kind = Kind::F32;
-			out.scalar.f32 = v.expect<float>();
-			return out;
+		if (recursive) {
+			if (isMap()) for (size_t i=0; i<len; i++) kvs[i].second.buildIndex(true);
+			if (isVec()) for (size_t i=0; i<len; i++) elems[i].buildIndex(true);
 		}
-		if (v.is<double>()) {
-			out.kind = Kind::F64;
-			out.scalar.f64 = v.expect<double>();
-			return out;
+	}
+
+	inline const Node& Node::operator[](size_t i) const {
+		if (isVec()) {
+			assert(i < len);
+			return elems[i];
 		}
-		if (v.is<bool>()) {
-			out.kind = Kind::Boolean;
-			out.scalar.boolean = v.expect<bool>();
-			return out;
+		if (isMap()) {
+			// An integer key.
+			const KeyValue* kv = find(static_cast<int64_t>(i));
+			if (kv) return kv->second;
+			throw std::runtime_error("cbor::Node::operator[] missing integer key: " + std::to_string(i));
 		}
-		if (v.is<TextBuffer>()) {
-			out.kind = Kind::Text;
-			out.text = std::move(v.expect<TextBuffer>());
-			return out;
+		throw std::runtime_error("can only index a Node with an integer if it is a map or vec");
+	}
+
+	inline const Node& Node::operator[](std::string_view key) const {
+		const KeyValue* kv = find(key);
+		if (kv) return kv->second;
+		throw std::runtime_error("cbor::Node::operator[] missing key: " + std::string(key));
+	}
+
+
+	//
+	// Interns text map keys across documents.
+	//
+	// Pass one to `parseTree` (or `Document::parse`) and every text map key resolves to a canonical id, with its bytes
+	// stored once in the interner instead of once per occurrence. Look keys up with `Node::find(KeyId)`, which compares
+	// integers. The same interner can be used for any number of documents; it must outlive the trees parsed with it.
+	//
+	// Interned keys are never freed, so their number is capped at `maxKeys`: past that, new keys are not interned, and
+	// come out as plain text nodes (`keyId` 0) that `Node::find(KeyId)` does not match. Keys interned before still are.
+	//
+	struct KeyInterner {
+		static constexpr uint32_t kNoKey = 0;
+		static constexpr size_t kDefaultMaxKeys = 1 << 16;
+
+		inline explicit KeyInterner(size_t maxKeys = kDefaultMaxKeys) : maxKeys_(maxKeys) {}
+		KeyInterner(const KeyInterner&) = delete;
+		KeyInterner& operator=(const KeyInterner&) = delete;
+
+		// The id of `key`, adding it if needed. `kNoKey` if it is new but `maxKeys` are already interned.
+		inline KeyId intern(std::string_view key) {
+			// Most documents use few keys, so a cheap direct-mapped cache in front of the hash table catches nearly all of them.
+			uint32_t& cached = cache_[cacheSlot(key)];
+			if (cached != kNoKey and names_[cached - 1] == key) return KeyId { cached };
+
+			auto it = ids_.find(key);
+			if (it != ids_.end()) {
+				cached = it->second;
+				return KeyId { it->second };
+			}
+			if (names_.size() >= maxKeys_) return KeyId { kNoKey };
+
+			names_.emplace_back(key);
+			uint32_t id = static_cast<uint32_t>(names_.size());
+			ids_.emplace(std::string_view(names_.back()), id);
+			cached = id;
+			return KeyId { id };
 		}
-		if (v.is<ByteBuffer>()) {
-			out.kind = Kind::Bytes;
-			out.bytes = std::move(v.expect<ByteBuffer>());
-			return out;
+
+		// The id of `key`, or `kNoKey` if it was never interned.
+		inline KeyId lookup(std::string_view key) const {
+			auto it = ids_.find(key);
+			return KeyId { it == ids_.end() ? kNoKey : it->second };
+		}
+
+		inline std::string_view name(KeyId key) const {
+			assert(key.id != kNoKey and key.id <= names_.size());
+			return names_[key.id - 1];
 		}
-		if (v.is<TypedArrayBuffer>()) {
-			out.kind = Kind::TypedArray;
-			out.tab = std::move(v.expect<TypedArrayBuffer>());
+
+		inline size_t size() const { return names_.size(); }
+		inline size_t maxKeys() const { return maxKeys_; }
+
+		// A text node viewing the canonical copy of `key`. Past `maxKeys`, a plain text node for `key` instead, copied
+		// (into `arena`, if given) when `copy` is set, as `Node::fromData` does.
+		inline Node keyNode(std::string_view key, bool copy = false, Arena* arena = nullptr) {
+			KeyId id = intern(key);
+			if (id.id == kNoKey) return Node::fromData(Kind::Text, (const uint8_t*)key.data(), key.size(), copy, arena);
+			std::string_view canonical = name(id);
+			Node out = Node::fromData(Kind::Text, (const uint8_t*)canonical.data(), canonical.size(), false);
+			out.keyId = id.id;
 			return out;
 		}
-		*/
-		if (v.is<uint8_t>()) return Node::fromByte(v.expect<uint8_t>());
-		if (v.is<int64_t>()) return Node::fromInt(v.expect<int64_t>());
-		if (v.is<uint64_t>()) return Node::fromUint(v.expect<uint64_t>());
-		if (v.is<float>()) return Node::fromFloat(v.expect<float>());
-		if (v.is<double>()) return Node::fromFloat(v.expect<double>());
-		if (v.is<bool>()) return Node::fromFloat(v.expect<bool>());
-		if (v.is<TextBuffer>()) return Node::fromTextBuffer(std::move(v.expect<TextBuffer>()));
-		if (v.is<ByteBuffer>()) return Node::fromBytes(std::move(v.expect<ByteBuffer>()));
-		if (v.is<TypedArrayBuffer>()) return Node::fromTypedArray(std::move(v.expect<TypedArrayBuffer>()));
 
-		if (v.is<BeginMap>()) {
-			return parseMap(p, std::move(v.expect<BeginMap>()));
+		private:
+		static constexpr size_t kCacheSize = 256;
+
+		static inline size_t cacheSlot(std::string_view key) {
+			size_t h = key.size();
+			if (!key.empty()) h = h * 31 + (uint8_t)key.front() * 7 + (uint8_t)key.back() + (uint8_t)key[key.size() / 2] * 131;
+			return h % kCacheSize;
+		}
+
+		std::deque<std::string> names_; // A deque, so that the views in `ids_` and in key nodes stay valid
+		std::unordered_map<std::string_view, uint32_t> ids_;
+		uint32_t cache_[kCacheSize] = {};
+		size_t maxKeys_;
+	};
+
+
+	//
+	// A set of key paths to keep when parsing, compiled into a trie.
+	//
+	//     Projection fields({ "header.id", "payload.samples" });
+	//     Node root = parseTree(CborParser(BinStreamBuffer{data, len}), fields);
+	//
+	// Map entries on none of the paths are skipped at the encoding level, without building nodes for them. Whatever is
+	// at the end of a path is kept whole. Arrays do not consume a path component: the projection applies to each
+	// element. Only text keys can match.
+	//
+	struct Projection {
+		static constexpr uint32_t kAll  = ~0u;     // Keep everything below
+		static constexpr uint32_t kSkip = ~0u - 1; // Not on any path
+
+		inline Projection() : nodes_(1) {}
+
+		// Paths with components separated by `sep`.
+		inline Projection(std::initializer_list<std::string_view> paths, char sep = '.') : nodes_(1) {
+			for (auto path : paths) add(path, sep);
+		}
+
+		inline Projection& add(std::string_view path, char sep = '.') {
+			std::vector<std::string_view> keys;
+			size_t start = 0;
+			while (true) {
+				size_t end = path.find(sep, start);
+				keys.push_back(path.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+				if (end == std::string_view::npos) break;
+				start = end + 1;
+			}
+			return addKeys(keys);
 		}
-		if (v.is<BeginArray>()) {
-			return parseArray(p, std::move(v.expect<BeginArray>()));
+
+		// A path given as its components, for keys that contain the separator.
+		inline Projection& addKeys(const std::vector<std::string_view>& keys) {
+			uint32_t at = 0;
+			for (auto key : keys) {
+				if (nodes_[at].all) return *this; // A prefix is already kept whole
+				uint32_t next = kSkip;
+				for (auto& c : nodes_[at].children)
+					if (c.first == key) next = c.second;
+				if (next == kSkip) {
+					next = static_cast<uint32_t>(nodes_.size());
+					nodes_[at].children.emplace_back(std::string(key), next);
+					nodes_.emplace_back();
+				}
+				at = next;
+			}
+			nodes_[at].all = true;
+			nodes_[at].children.clear();
+			return *this;
 		}
 
-		if (v.is<Null>()) {
-			return Node::fromNull();
+		// The state of the root value.
+		inline uint32_t root() const { return nodes_[0].all ? kAll : 0; }
+
+		// The state of the value at `key` in a map with state `state` (not `kAll`).
+		inline uint32_t child(uint32_t state, std::string_view key) const {
+			for (auto& c : nodes_[state].children)
+				if (c.first == key) return nodes_[c.second].all ? kAll : c.second;
+			return kSkip;
 		}
 
-		if (v.is<End>()) {
-			assert(false && "the End token cannot be returned as a Node");
+		private:
+		struct Trie {
+			std::vector<std::pair<std::string, uint32_t>> children;
+			bool all = false;
+		};
+		std::vector<Trie> nodes_;
+	};
+
+
+	//
+	// The parse functions are templated on the parser type, so any `BasicCborParser<Stream>` may be used.
+	//
+	// Parsing and encoding are loops over an explicit stack of open containers, not recursive calls, so they use a
+	// bounded amount of (machine) stack at any depth. For parsing, the depth is bounded by the parser's `kMaxDepth`.
+	//
+	// Definite-length containers get their exactly sized children array up front and are filled in place.
+	// Children of indefinite-length containers, and of maps being projected (where the number of kept pairs is not known
+	// up front), are collected in a scratch vector shared by all levels (a container's children are always at its tail),
+	// then moved into an exactly sized array when the container closes.
+	//
+
+	namespace {
+		// Nodes outlive the parser, so views handed out by streams without stable views must be copied.
+		template <class Parser> inline Node retain(Kind kind, const Item& v, Arena* arena) {
+			return Node::fromData(kind, v.ptr, v.size, !Parser::StreamType::kStableViews, arena);
+		}
+
+		template <class Parser>
+		inline Node scalarNode(const Item& v, Arena* arena) {
+			switch (v.type) {
+				case ItemType::Byte: return Node::fromByte(v.byte);
+				case ItemType::Int64: return Node::fromInt(v.int64);
+				case ItemType::Uint64: return Node::fromUint(v.uint64);
+				case ItemType::F32: return Node::fromFloat(v.f32);
+				case ItemType::F64: return Node::fromDouble(v.f64);
+				case ItemType::Bool: return Node::fromBool(v.boolean);
+				case ItemType::Null: return Node::fromNull();
+				case ItemType::Text: return retain<Parser>(Kind::Text, v, arena);
+				case ItemType::Bytes: return retain<Parser>(Kind::Bytes, v, arena);
+				case ItemType::TypedArray: {
+					Node out = retain<Parser>(Kind::TypedArray, v, arena);
+					out.taType = v.taType;
+					out.taEndian = v.taEndian;
+					return out;
+				}
+				default:
+					assert(false && "not a scalar");
+					return Node {};
+			}
 		}
 
-		assert(false);
 	}
 
-	inline Node parseMap(CborParser& p, BeginMap&& begin) {
-		auto len = begin.size;
+	//
+	// Parse the value that starts with item `v` (already taken from `p`).
+	// `scratch` is only used while parsing and is left empty, but keeps its capacity (see `Document`).
+	// With `keys`, text map keys are interned. With `projection`, only the map entries on its paths are kept.
+	//
+	template <class Parser>
+	inline Node parseOne(Parser& p, Item v, Arena* arena, std::vector<Node>& scratch, KeyInterner* keys = nullptr, const Projection* projection = nullptr) {
+		assert(!v.is<End>() && "the End token cannot be returned as a Node");
 
-		Node out;
-		out.kind = Kind::Map;
-		if (len != kInvalidLength) out.map.reserve(len);
+		// An open container while parsing. Local, since the lambdas below capture it and are part of an inline function.
+		struct ParseFrame {
+			Node* elems;         // Filled in place vec: its children
+			KeyValue* kvs;       // Filled in place map: its pairs
+			size_t len;          // Children in the input (keys and values both count for a map), or `kIndefiniteLength`
+			size_t filled;       // Children consumed from the input, including skipped ones
+			size_t scratchBegin; // Collected: where its children start in the scratch vector
+			uint32_t proj;       // Projection state of the container (`Projection::kAll`: keep everything)
+			uint32_t valueProj;  // Projected map: the state of the value after the current key
+			bool map;
+			bool collect;        // Children go to the scratch vector (indefinite, or projected map)
+		};
 
-		p.consumeMap(len, [&](Item&& k, Item&& v) {
-			// TextBuffer key { k.expect<TextBuffer>() };
-			Node key { parseOne(p, std::move(k)) };
-			Node value { parseOne(p, std::move(v)) };
-			// out.map.emplace_back(std::make_pair(std::move(key), std::move(value)));
-			out.map.push_back(std::make_pair(std::move(key), std::move(value)));
-		});
+		ParseFrame stack[std::remove_reference_t<Parser>::kMaxDepth + 1];
+		size_t depth = 0;
+		Node root;
+		size_t scratchBase = scratch.size();
 
-		return out;
+		// Put a finished child into the innermost open container (or make it the root).
+		auto place = [&](Node&& n) {
+			if (depth == 0) {
+				root = std::move(n);
+				return;
+			}
+			ParseFrame& f = stack[depth - 1];
+			if (f.collect) scratch.push_back(std::move(n));
+			else if (!f.map) f.elems[f.filled] = std::move(n);
+			else if (f.filled % 2 == 0) f.kvs[f.filled / 2].first = std::move(n);
+			else f.kvs[f.filled / 2].second = std::move(n);
+			f.filled++;
+		};
+
+		// Close the innermost container, moving its children out of the scratch vector.
+		auto finish = [&]() {
+			ParseFrame& f = stack[depth - 1];
+			size_t n = scratch.size() - f.scratchBegin;
+			Node out;
+			if (f.map) {
+				if (n % 2) throw std::runtime_error("cbor: map ended between a key and its value.");
+				out = Node::allocMap(n / 2, arena);
+				for (size_t i=0; i<n/2; i++) {
+					out.kvs[i].first = std::move(scratch[f.scratchBegin + 2 * i]);
+					out.kvs[i].second = std::move(scratch[f.scratchBegin + 2 * i + 1]);
+				}
+			} else {
+				out = Node::allocVec(n, arena);
+				for (size_t i=0; i<n; i++) out.elems[i] = std::move(scratch[f.scratchBegin + i]);
+			}
+			scratch.resize(f.scratchBegin);
+			depth--;
+			place(std::move(out));
+		};
+
+		// At a key of a projected map: skip the pair if the key is on no path.
+		auto skipPair = [&]() {
+			if (depth == 0) return false;
+			ParseFrame& f = stack[depth - 1];
+			if (!f.map or f.proj == Projection::kAll or f.filled % 2 or v.is<End>()) return false;
+
+			f.valueProj = v.type == ItemType::Text ? projection->child(f.proj, std::string_view((const char*)v.ptr, v.size)) : Projection::kSkip;
+			if (f.valueProj != Projection::kSkip) return false;
+
+			if (v.type == ItemType::BeginArray or v.type == ItemType::BeginMap) p.skipRemaining(v); // A container key
+			p.skipValue();
+			f.filled += 2;
+			return true;
+		};
+
+		while (true) {
+			if (!skipPair()) switch (v.type) {
+				case ItemType::BeginArray:
+				case ItemType::BeginMap: {
+					bool map = v.type == ItemType::BeginMap;
+					uint32_t proj = Projection::kAll;
+					if (depth == 0) proj = projection ? projection->root() : Projection::kAll;
+					else if (stack[depth - 1].proj != Projection::kAll) proj = stack[depth - 1].map ? stack[depth - 1].valueProj : stack[depth - 1].proj;
+
+					ParseFrame f { nullptr, nullptr, map ? 2 * v.size : v.size, 0, scratch.size(), proj, Projection::kSkip, map, true };
+					if (v.size == kIndefiniteLength) {
+						f.len = kIndefiniteLength;
+					} else if (!map or proj == Projection::kAll) {
+						Node n = map ? Node::allocMap(v.size, arena) : Node::allocVec(v.size, arena);
+						f.elems   = map ? nullptr : n.elems;
+						f.kvs     = map ? n.kvs : nullptr;
+						f.collect = false;
+						place(std::move(n));
+					}
+					stack[depth++] = f;
+					break;
+				}
+
+				case ItemType::End:
+					// Only indefinite containers see their break.
+					assert(depth > 0 and stack[depth - 1].len == kIndefiniteLength);
+					finish();
+					break;
+
+				case ItemType::Text:
+					if (keys and depth > 0 and stack[depth - 1].map and stack[depth - 1].filled % 2 == 0) {
+						place(keys->keyNode(std::string_view((const char*)v.ptr, v.size), !Parser::StreamType::kStableViews, arena));
+						break;
+					}
+					place(scalarNode<Parser>(v, arena));
+					break;
+
+				default:
+					place(scalarNode<Parser>(v, arena));
+			}
+
+			// Definite containers close when full.
+			while (depth > 0 and stack[depth - 1].len != kIndefiniteLength and stack[depth - 1].filled == stack[depth - 1].len) {
+				if (stack[depth - 1].collect) finish();
+				else depth--;
+			}
+			if (depth == 0) break;
+
+			v = p.next();
+			if (v.is<End>() and stack[depth - 1].len != kIndefiniteLength) throw std::runtime_error("cbor: input ended inside a container.");
+		}
+
+		assert(scratch.size() == scratchBase);
+		return root;
 	}
 
-	inline Node parseArray(CborParser& p, BeginArray&& begin) {
-		auto len = begin.size;
+	template <class Parser>
+	inline Node parseOne(Parser& p, Item v, Arena* arena = nullptr) {
+		std::vector<Node> scratch;
+		return parseOne(p, v, arena, scratch);
+	}
 
-		Node out;
-		out.kind = Kind::Vec;
-		if (len != kInvalidLength) out.vec.reserve(len);
+	template <class Parser>
+	inline Node parseMap(Parser& p, BeginMap&& begin, Arena* arena = nullptr) {
+		return parseOne(p, Item::fromBeginMap(begin.size), arena);
+	}
+
+	template <class Parser>
+	inline Node parseArray(Parser& p, BeginArray&& begin, Arena* arena = nullptr) {
+		return parseOne(p, Item::fromBeginArray(begin.size), arena);
+	}
 
-		p.consumeArray(len, [&](Item&& v) {
-			Node value { parseOne(p, std::move(v)) };
-			// out.map.emplace_back(std::make_pair(std::move(key), std::move(value)));
-			out.vec.push_back(std::move(value));
-		});
+	// Keep only the entries on the paths of `projection` (see `Projection`).
+	template <class Parser>
+	inline Node parseMap(Parser& p, BeginMap&& begin, const Projection& projection, Arena* arena = nullptr) {
+		std::vector<Node> scratch;
+		return parseOne(p, Item::fromBeginMap(begin.size), arena, scratch, nullptr, &projection);
+	}
 
-		return out;
+	template <class Parser>
+	inline Node parseArray(Parser& p, BeginArray&& begin, const Projection& projection, Arena* arena = nullptr) {
+		std::vector<Node> scratch;
+		return parseOne(p, Item::fromBeginArray(begin.size), arena, scratch, nullptr, &projection);
+	}
+
+	// With an `arena`, every allocation the tree needs comes from it (see `Arena`). With `keys`, map keys are interned.
+	// Empty input gives an empty `Node`.
+	template <class Parser>
+	inline Node parseTree(Parser&& p, Arena* arena = nullptr, KeyInterner* keys = nullptr) {
+		Item it = p.next();
+		if (it.is<End>()) return Node {};
+		std::vector<Node> scratch;
+		return parseOne(p, it, arena, scratch, keys);
+	}
+
+	template <class Parser>
+	inline Node parseTree(Parser&& p, const Projection& projection, Arena* arena = nullptr, KeyInterner* keys = nullptr) {
+		Item it = p.next();
+		if (it.is<End>()) return Node {};
+		std::vector<Node> scratch;
+		return parseOne(p, it, arena, scratch, keys, &projection);
 	}
-	
-	inline void encodeOne(CborEncoder& ce, const Node& node) {
-		assert(!node.isInvalid());
 
-		if (node.isMap()) {
-			ce.begin_map(node.size());
-			for (const auto &kv : node.map) {
-				encodeOne(ce, kv.first);
-				encodeOne(ce, kv.second);
+	namespace {
+		template <class Encoder>
+		inline void encodeScalar(Encoder& ce, const Node& node) {
+			// NOTE: CborEncoder will compress integers based on size. No need to implement logic here too.
+			if (node.kind == Kind::Byte) ce.push_value(node.scalar.byte);
+			else if (node.kind == Kind::Int64) ce.push_value(node.scalar.int64);
+			else if (node.kind == Kind::Uint64) ce.push_value(node.scalar.uint64);
+			else if (node.kind == Kind::F32) ce.push_value(node.scalar.f32);
+			else if (node.kind == Kind::F64) ce.push_value(node.scalar.f64);
+			else if (node.kind == Kind::Text) ce.push_value(TextBuffer(node.ptr, node.len));
+			else if (node.kind == Kind::Bytes) ce.push_value(node.asBytes());
+			else if (node.kind == Kind::TypedArray) ce.push_value(node.asTypedArray());
+			else if (node.kind == Kind::Null) ce.push_value(Null{});
+			else if (node.kind == Kind::Boolean) {
+				if (node.scalar.boolean) ce.push_value(True{});
+				else ce.push_value(False{});
 			}
-		}
-		else if (node.isVec()) {
-			ce.begin_array(node.size());
-			for (const auto &v : node.vec) {
-				encodeOne(ce, v);
+			else {
+				throw std::runtime_error("impossible: failed to match node kind.");
 			}
 		}
+	}
+
+	// Any `BasicCborEncoder` works; a concrete one (e.g. `CborBufferEncoder`) avoids the indirection of `CborEncoder`.
+	template <class Encoder>
+	inline void encodeTree(Encoder& ce, const Node& root) {
+		// Open containers: the node, and the index of the next child (keys and values both count for a map).
+		// The first `kInlineFrames` live on the (machine) stack, so only trees deeper than that allocate.
+		struct Frame {
+			const Node* node;
+			size_t next;
+		};
+		constexpr size_t kInlineFrames = 64;
+		Frame inlineFrames[kInlineFrames];
+		std::vector<Frame> spill;
+		size_t depth = 0;
 
-		// Invalid, Byte, Int64, Uint64, F32, F64, Boolean, Text, Bytes, TypedArray, Map, Vec
+		auto push = [&](const Node* n) {
+			if (depth < kInlineFrames) inlineFrames[depth] = Frame { n, 0 };
+			else spill.push_back(Frame { n, 0 });
+			depth++;
+		};
 
-		// NOTE: CborEncoder will compress integers based on size. No need to implement logic here too.
-		else if (node.kind == Kind::Byte) ce.push_value(node.scalar.byte);
-		else if (node.kind == Kind::Int64) ce.push_value(node.scalar.int64);
-		else if (node.kind == Kind::Uint64) ce.push_value(node.scalar.uint64);
-		else if (node.kind == Kind::F32) ce.push_value(node.scalar.f32);
-		else if (node.kind == Kind::F64) ce.push_value(node.scalar.f64);
-		else if (node.kind == Kind::Text) ce.push_value(node.text);
-		else if (node.kind == Kind::Bytes) ce.push_value(node.bytes);
-		else if (node.kind == Kind::TypedArray) ce.push_value(node.tab);
-		else if (node.kind == Kind::Boolean) {
-            if (node.scalar.boolean) ce.push_value(True{});
-            else ce.push_value(False{});
-        }
+		const Node* node = &root;
+		while (true) {
+			assert(!node->isInvalid());
 
-		else {
-			throw std::runtime_error("impossible: failed to match node kind.");
+			if (node->isMap()) {
+				ce.begin_map(node->size());
+				push(node);
+			} else if (node->isVec()) {
+				ce.begin_array(node->size());
+				push(node);
+			} else {
+				encodeScalar(ce, *node);
+			}
+
+			// Find the next child to encode, closing finished containers.
+			node = nullptr;
+			while (depth > 0) {
+				Frame& f = depth > kInlineFrames ? spill.back() : inlineFrames[depth - 1];
+				size_t n = f.node->isMap() ? 2 * f.node->len : f.node->len;
+				if (f.next < n) {
+					size_t i = f.next++;
+					if (f.node->isVec()) node = &f.node->elems[i];
+					else node = i % 2 == 0 ? &f.node->kvs[i / 2].first : &f.node->kvs[i / 2].second;
+					break;
+				}
+				if (depth > kInlineFrames) spill.pop_back();
+				depth--;
+			}
+			if (!node) break;
 		}
 	}
 
+	template <class Encoder>
+	inline void encodeOne(Encoder& ce, const Node& node) {
+		encodeTree(ce, node);
+	}
+
+	// The exact size of `encodeTree(ce, node)`'s output.
+	inline size_t encodedSize(const Node& node) {
+		CborSizer sizer;
+		encodeTree(sizer, node);
+		return sizer.finish();
+	}
+
+
+	//
+	// A parsed tree together with all the storage it needs, for parsing many similar messages in a row.
+	//
+	// Each `parse` starts by resetting the document, which forgets the previous tree but keeps the arena chunks (nodes,
+	// children arrays and copied strings) and the scratch vector used for indefinite-length containers. Once the
+	// capacity has grown to fit the largest message, parsing does no allocation at all.
+	//
+	// The tree is only valid until the next `parse` or `reset`, and, for buffer input, only as long as the input.
+	//
+	struct Document {
+
+		inline explicit Document(size_t chunkSize = Arena::kDefaultChunkSize) : arena_(chunkSize) {}
+
+		Document(const Document&) = delete;
+		Document& operator=(const Document&) = delete;
+
+		// With `keys`, map keys are interned (see `KeyInterner`). With `projection`, only its paths are kept.
+		template <class Parser>
+		inline const Node& parse(Parser&& p, KeyInterner* keys = nullptr, const Projection* projection = nullptr) {
+			reset();
+			Item it = p.next();
+			if (!it.is<End>()) root_ = parseOne(p, it, &arena_, scratch_, keys, projection);
+			return root_;
+		}
+
+		inline const Node& parse(const byte* data, size_t len, KeyInterner* keys = nullptr) {
+			return parse(CborParser(BinStreamBuffer{data, len}), keys);
+		}
+
+		inline void reset() {
+			root_ = Node {};
+			scratch_.clear(); // Not empty only if a parse threw.
+			arena_.reset();
+		}
 
+		inline const Node& root() const { return root_; }
+		inline Node& root() { return root_; } // e.g. to `buildIndex()`
 
+		inline const Arena& arena() const { return arena_; }
 
-	inline Node parseTree(CborParser&& p) {
-		auto it = p.next();
-		return parseOne(p, std::move(it));
+		private:
+		Arena arena_;
+		std::vector<Node> scratch_;
+		Node root_;
+	};
+
+
+	//
+	// Trees that share ownership of their input.
+	//
+	// `parseShared` parses out of a refcounted slab (`BinStreamShared`, or `BinStreamMapped`) into a `SharedNode`: a
+	// shared pointer to the root that also keeps the tree's storage and the slab alive. Strings, byte strings and typed
+	// arrays stay views into the slab, so nothing is copied, and the tree can be cached or handed to other threads.
+	// `share` makes a `SharedNode` for a sub-node, and `sharedTypedArray`/`sharedBytes` make buffers that own a
+	// reference too.
+	//
+	using SharedNode = std::shared_ptr<const Node>;
+
+	namespace {
+		struct SharedTree {
+			std::shared_ptr<const byte> slab;
+			Document doc;
+		};
 	}
 
-	inline void encodeTree(CborEncoder& ce, const Node& root) {
-		encodeOne(ce, root);
+	template <class Stream, size_t MaxDepth>
+	inline SharedNode parseShared(BasicCborParser<Stream, MaxDepth>&& p) {
+		static_assert(std::is_base_of_v<BinStreamShared, Stream>, "parseShared needs a stream over a shared slab");
+		auto tree = std::make_shared<SharedTree>();
+		tree->slab = p.strm.slab();
+		const Node& root = tree->doc.parse(p);
+		return SharedNode(tree, &root);
 	}
 
+	inline SharedNode parseShared(std::vector<uint8_t>&& data) {
+		return parseShared(CborSharedParser(BinStreamShared::fromVector(std::move(data))));
+	}
+
+	// A `SharedNode` for `sub`, which must be part of `tree`.
+	inline SharedNode share(const SharedNode& tree, const Node& sub) {
+		return SharedNode(tree, &sub);
+	}
+
+	inline TypedArrayBuffer sharedTypedArray(const SharedNode& node) {
+		TypedArrayBuffer out = node->asTypedArray();
+		out.owner = node;
+		return out;
+	}
+
+	inline ByteBuffer sharedBytes(const SharedNode& node) {
+		ByteBuffer out = node->asBytes();
+		out.owner = node;
+		return out;
+	}
 
 }
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "cbor_parser.hpp"
+
+//
+// An on-demand cursor over an encoded buffer.
+//
+// A `CborView` points at one encoded value. Lookups (`operator[]`, iteration) scan the encoding from there and skip
+// over whatever is not asked for, so nothing is allocated and no tree is kept. This suits reading a few fields out of a
+// large message; for touching most of a document, `parseTree` or `CborParser` is cheaper since every lookup re-scans.
+//
+//     CborView root(data, len);
+//     int64_t id      = root["header"]["id"].as<int64_t>();
+//     std::string_view name = root["names"][2].as<std::string_view>();
+//
+// A lookup that finds nothing returns an invalid view (test with `valid()` or `operator bool`), so lookups can be
+// chained; only `as<T>()` throws. The buffer must outlive every view into it.
+//
+
+namespace cbor {
+
+	template <bool IsMap> struct CborViewIterator;
+	template <bool IsMap> struct CborViewRange;
+
+	struct CborView {
+
+		inline CborView() {}
+		inline CborView(const byte* data, size_t len) : ptr_(data), end_(data + len) {}
+
+		inline bool valid() const { return ptr_ != nullptr; }
+		inline explicit operator bool() const { return valid(); }
+
+		// Where the encoded value starts.
+		inline const byte* data() const { return ptr_; }
+
+		// The head of the value (for containers, the size is as encoded: `kIndefiniteLength` for indefinite ones).
+		inline Item item() const {
+			if (!valid()) return Item::fromEnd();
+			BinStreamBuffer strm(ptr_, end_ - ptr_);
+			return readItem(strm);
+		}
+
+		inline ItemType type() const { return item().type; }
+		inline bool isMap() const { return type() == ItemType::BeginMap; }
+		inline bool isArray() const { return type() == ItemType::BeginArray; }
+		inline bool isNull() const { return type() == ItemType::Null; }
+
+		// The encoded size of the whole value, including its children.
+		inline size_t encodedSize() const {
+			if (!valid()) return 0;
+			BinStreamBuffer strm(ptr_, end_ - ptr_);
+			skipItems<kDefaultMaxDepth>(strm, 1);
+			return strm.cursor();
+		}
+
+		// Number of elements (array) or pairs (map). Indefinite-length containers are counted by scanning.
+		inline size_t size() const;
+
+		// Map: the value of text key `key`.
+		inline CborView operator[](std::string_view key) const;
+
+		// Array: the `i`th element. Map: the value of integer key `i`.
+		inline CborView operator[](size_t i) const;
+
+		//
+		// The value as `T`: `int64_t`, `uint64_t`, `float`, `double`, `bool`, `std::string_view`, or a view type
+		// `TextBuffer`, `ByteBuffer`, `TypedArrayBuffer`. Integers convert between each other when the value fits, and
+		// floats widen or narrow. Throws if the value does not hold a `T`.
+		//
+		template <class T> inline T as() const;
+
+		//
+		// Iteration over children: `elements()` for arrays, `entries()` for maps (see `CborViewIterator`).
+		//
+		inline CborViewRange<false> elements() const;
+		inline CborViewRange<true> entries() const;
+
+		private:
+
+		// An iterator at the first child of a container whose head is `it`.
+		template <bool IsMap>
+		inline CborViewIterator<IsMap> children(const Item& it) const;
+
+		template <class Match>
+		inline CborView findEntry(Match&& match) const;
+
+		const byte* ptr_ = nullptr;
+		const byte* end_ = nullptr;
+	};
+
+	struct CborViewEntry {
+		CborView key;
+		CborView value;
+	};
+
+	//
+	// Walks the children of a container: `CborView`s of elements, or `CborViewEntry`s of pairs.
+	// Advancing skips over the current child's encoding.
+	//
+	template <bool IsMap>
+	struct CborViewIterator {
+		const byte* pos = nullptr;
+		const byte* end = nullptr;
+		size_t remaining = 0; // Children left, or `kIndefiniteLength` (until a break byte)
+
+		inline bool atEnd() const {
+			return pos == nullptr or remaining == 0 or (remaining == kIndefiniteLength and pos < end and *pos == 0xff);
+		}
+		inline bool operator==(const CborViewIterator& o) const { return atEnd() and o.atEnd(); }
+		inline bool operator!=(const CborViewIterator& o) const { return !(*this == o); }
+
+		inline auto operator*() const {
+			if constexpr (IsMap) {
+				CborView key(pos, end - pos);
+				size_t keySize = key.encodedSize();
+				return CborViewEntry { key, CborView(pos + keySize, end - pos - keySize) };
+			} else {
+				return CborView(pos, end - pos);
+			}
+		}
+
+		inline CborViewIterator& operator++() {
+			BinStreamBuffer strm(pos, end - pos);
+			skipItems<kDefaultMaxDepth>(strm, IsMap ? 2 : 1);
+			pos += strm.cursor();
+			if (remaining != kIndefiniteLength) remaining--;
+			return *this;
+		}
+	};
+
+	template <bool IsMap>
+	struct CborViewRange {
+		CborViewIterator<IsMap> first;
+		inline CborViewIterator<IsMap> begin() const { return first; }
+		inline CborViewIterator<IsMap> end() const { return CborViewIterator<IsMap> {}; }
+	};
+
+	template <bool IsMap>
+	inline CborViewIterator<IsMap> CborView::children(const Item& it) const {
+		BinStreamBuffer strm(ptr_, end_ - ptr_);
+		readItem(strm);
+		return CborViewIterator<IsMap> { ptr_ + strm.cursor(), end_, it.size };
+	}
+
+	inline CborViewRange<false> CborView::elements() const {
+		Item it = item();
+		if (it.type != ItemType::BeginArray) throw std::runtime_error("cbor::CborView::elements() on a value that is not an array.");
+		return CborViewRange<false> { children<false>(it) };
+	}
+
+	inline CborViewRange<true> CborView::entries() const {
+		Item it = item();
+		if (it.type != ItemType::BeginMap) throw std::runtime_error("cbor::CborView::entries() on a value that is not a map.");
+		return CborViewRange<true> { children<true>(it) };
+	}
+
+	template <class Match>
+	inline CborView CborView::findEntry(Match&& match) const {
+		if (!valid()) return {};
+		Item it = item();
+		if (it.type != ItemType::BeginMap) return {};
+		for (auto i = children<true>(it); !i.atEnd(); ++i) {
+			BinStreamBuffer strm(i.pos, i.end - i.pos);
+			Item key = readItem(strm);
+			if (match(key)) {
+				// Only scalar keys match, so the value starts right after the key.
+				return CborView(i.pos + strm.cursor(), i.end - i.pos - strm.cursor());
+			}
+		}
+		return {};
+	}
+
+	inline size_t CborView::size() const {
+		Item it = item();
+		if (it.type != ItemType::BeginArray and it.type != ItemType::BeginMap) throw std::runtime_error("cbor::CborView::size() on a value that is not a container.");
+		if (it.size != kIndefiniteLength) return it.size;
+
+		size_t n = 0;
+		if (it.type == ItemType::BeginMap)
+			for (auto i = children<true>(it); !i.atEnd(); ++i) n++;
+		else
+			for (auto i = children<false>(it); !i.atEnd(); ++i) n++;
+		return n;
+	}
+
+	inline CborView CborView::operator[](std::string_view key) const {
+		return findEntry([&](const Item& k) {
+			return k.type == ItemType::Text and std::string_view((const char*)k.ptr, k.size) == key;
+		});
+	}
+
+	inline CborView CborView::operator[](size_t i) const {
+		if (!valid()) return {};
+		Item it = item();
+
+		if (it.type == ItemType::BeginArray) {
+			auto c = children<false>(it);
+			for (size_t j=0; j<i and !c.atEnd(); j++) ++c;
+			if (c.atEnd()) return {};
+			return *c;
+		}
+
+		return findEntry([&](const Item& k) {
+			auto v = k.asUInt();
+			return v and k.type != ItemType::Int64 and *v == i;
+		});
+	}
+
+	template <class T>
+	inline T CborView::as() const {
+		Item it = item();
+		auto fail = [&]() -> T { throw std::runtime_error("cbor::CborView::as() type mismatch: " + it.toString()); };
+
+		if constexpr (std::is_same_v<T, int64_t>) {
+			// Unsigned values above `INT64_MAX` do not fit.
+			auto v = it.asInt();
+			bool fits = it.type != ItemType::Uint64 or it.uint64 <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+			return v and fits ? *v : fail();
+		} else if constexpr (std::is_same_v<T, uint64_t>) {
+			// Nor do negative ones.
+			auto v = it.asUInt();
+			bool fits = it.type != ItemType::Int64 or it.int64 >= 0;
+			return v and fits ? *v : fail();
+		} else if constexpr (std::is_same_v<T, float> or std::is_same_v<T, double>) {
+			auto v = it.asDouble();
+			return v ? static_cast<T>(*v) : fail();
+		} else if constexpr (std::is_same_v<T, bool>) {
+			return it.type == ItemType::Bool ? it.boolean : fail();
+		} else if constexpr (std::is_same_v<T, std::string_view>) {
+			auto v = it.asStringView();
+			return v ? *v : fail();
+		} else if constexpr (std::is_same_v<T, TextBuffer> or std::is_same_v<T, ByteBuffer> or std::is_same_v<T, TypedArrayBuffer>) {
+			if (!it.is<T>()) return fail();
+			return it.expect<T>();
+		} else {
+			static_assert(!sizeof(T), "CborView::as<T>() does not support this type");
+		}
+	}
+
+}
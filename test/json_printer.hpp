@@ -2,13 +2,14 @@
 
 namespace {
 using namespace cbor;
+template <class Parser>
 struct JsonPrinter {
 
-	CborParser &p;
+	Parser &p;
 
 	std::string os;
 
-	inline JsonPrinter(CborParser& p_) : p(p_) {
+	inline JsonPrinter(Parser& p_) : p(p_) {
 		visitRoot();
 	}
 
@@ -27,7 +28,7 @@ struct JsonPrinter {
 	inline void visitArray(const Item& it) {
 		int i = 0;
 		os += "[";
-		p.consumeArray(std::get<BeginArray>(it.value).size, [&i,this](Item&& v) {
+		p.consumeArray(it.expect<BeginArray>().size, [&i,this](Item v) {
 				if (i != 0) os += ",";
 				visitItem(v);
 				i++;
@@ -38,7 +39,7 @@ struct JsonPrinter {
 	inline void visitMap(const Item& it) {
 		int i = 0;
 		os += "{";
-		p.consumeMap(std::get<BeginMap>(it.value).size, [&i,this](Item&& k, Item&& v) {
+		p.consumeMap(it.expect<BeginMap>().size, [&i,this](Item k, Item v) {
 				if (i != 0) os += ",";
 				auto ks = k.toString();
 				if (ks[0] == '"') os += ks;
@@ -53,21 +54,16 @@ struct JsonPrinter {
 
 
 	inline void visitItem(const Item& v) {
-		if (std::holds_alternative<BeginMap>(v.value)) {
+		if (v.is<BeginMap>()) {
 			visitMap(v);
-		} else if (std::holds_alternative<BeginArray>(v.value)) {
+		} else if (v.is<BeginArray>()) {
 			visitArray(v);
-
-		} else if (std::holds_alternative<EndMap>(v.value)) {
-			assert(false);
-		} else if (std::holds_alternative<EndArray>(v.value)) {
-			assert(false);
 		}
 
-		else if (std::holds_alternative<TypedArrayBuffer>(v.value)) {
+		else if (v.is<TypedArrayBuffer>()) {
 			os += "<NO TYPED ARRAYS IN JSON>";
 		}
-		else if (std::holds_alternative<ByteBuffer>(v.value)) {
+		else if (v.is<ByteBuffer>()) {
 			os += "<NO BYTE STRINGS IN JSON>";
 		} else {
 			os += v.toString();
@@ -2,6 +2,10 @@
 
 #include <fstream>
 
+#include "cborCodec/cbor_tape.hpp"
+#include "cborCodec/cbor_sax.hpp"
+#include "cborCodec/cbor_tree_parser.hpp"
+#include "cborCodec/cbor_parallel.hpp"
 #include "json_printer.hpp"
 #include "timing.hpp"
 
@@ -65,3 +69,146 @@ TEST(Parser, BigJson_BufferInput) {
 	ofs << jp.os;
 
 }
+
+TEST(Parser, BigJson_MappedInput) {
+	std::string cborInputPath = "/tmp/big.cbor";
+	std::string cborOutputPath = "/tmp/big.fromCbor.mapped.json";
+
+	auto t0 = getMicros();
+	CborMappedParser p(BinStreamMapped{cborInputPath});
+	std::ofstream ofs(cborOutputPath);
+
+	std::cout << " - input size: " << static_cast<double>(p.strm.mapping()->size()) / (1<<20) << "MB\n";
+
+	auto t1 = getMicros();
+	JsonPrinter jp(p);
+	auto t2 = getMicros();
+
+	std::cout << " - [mapped input] 'big.cbor' parse took: " << (t2-t1) * 1e-3 << "ms\n";
+	std::cout << " - [mapped input] 'big.cbor' parse took including map: " << (t2-t0) * 1e-3 << "ms\n";
+
+	ofs << jp.os;
+
+	EXPECT_TRUE(files_are_same(cborOutputPath, "/tmp/big.fromCbor.buffer.json"));
+}
+
+TEST(Parser, BigJson_Tape) {
+	std::string cborInputPath = "/tmp/big.cbor";
+
+	MappedFile file(cborInputPath);
+
+	auto t0 = getMicros();
+	Tape tape = buildTape(file.data(), file.size());
+	auto t1 = getMicros();
+
+	std::cout << " - [tape] 'big.cbor' index took: " << (t1-t0) * 1e-3 << "ms (" << tape.size() << " entries)\n";
+
+	// The tape must agree with the parser about how many items there are.
+	CborParser p(BinStreamBuffer{file.data(), file.size()});
+	size_t n = 0;
+	while (p.hasMore()) {
+		if (!p.next().is<End>()) n++;
+	}
+	auto t2 = getMicros();
+	std::cout << " - [tape] 'big.cbor' CborParser::next() walk took: " << (t2-t1) * 1e-3 << "ms\n";
+	EXPECT_EQ(n, tape.size());
+
+	// Walking the top-level array by siblings.
+	size_t nTop = 0;
+	for (size_t i = tape.firstChild(0); i < tape[0].next; i = tape.nextSibling(i)) nTop++;
+	auto t3 = getMicros();
+	std::cout << " - [tape] 'big.cbor' sibling walk took: " << (t3-t2) * 1e-3 << "ms\n";
+	EXPECT_EQ(nTop, tape[0].count);
+}
+
+TEST(Parser, BigJson_Sax) {
+	std::string cborInputPath = "/tmp/big.cbor";
+
+	MappedFile file(cborInputPath);
+
+	struct Counter : SaxHandler<Counter> {
+		size_t items = 0;
+		void on_uint(uint64_t) { items++; }
+		void on_int(int64_t) { items++; }
+		void on_float(float) { items++; }
+		void on_double(double) { items++; }
+		void on_bool(bool) { items++; }
+		void on_null() { items++; }
+		void on_simple(uint8_t) { items++; }
+		void on_text(std::string_view) { items++; }
+		void on_bytes(const byte*, size_t) { items++; }
+		void on_typed_array(TypedArrayBuffer::Type, bool, const byte*, size_t) { items++; }
+		void on_begin_map(size_t) { items++; }
+		void on_begin_array(size_t) { items++; }
+	} counter;
+
+	auto t0 = getMicros();
+	counter.parse(file.data(), file.size());
+	auto t1 = getMicros();
+	std::cout << " - [sax] 'big.cbor' push parse took: " << (t1-t0) * 1e-3 << "ms (" << counter.items << " items)\n";
+
+	CborParser p(BinStreamBuffer{file.data(), file.size()});
+	size_t n = 0;
+	while (p.hasMore()) {
+		if (!p.next().is<End>()) n++;
+	}
+	auto t2 = getMicros();
+	std::cout << " - [sax] 'big.cbor' CborParser::next() walk took: " << (t2-t1) * 1e-3 << "ms\n";
+	EXPECT_EQ(n, counter.items);
+}
+
+TEST(Parser, BigJson_Tree) {
+	std::string cborInputPath = "/tmp/big.cbor";
+
+	MappedFile file(cborInputPath);
+
+	{
+		auto t0 = getMicros();
+		Node root = parseTree(CborParser(BinStreamBuffer{file.data(), file.size()}));
+		auto t1 = getMicros();
+		root = Node{};
+		auto t2 = getMicros();
+		std::cout << " - [tree] 'big.cbor' heap parse took: " << (t1-t0) * 1e-3 << "ms, teardown took: " << (t2-t1) * 1e-3 << "ms\n";
+	}
+
+	Arena arena;
+	for (int i=0; i<2; i++) {
+		arena.reset();
+		auto t0 = getMicros();
+		Node root = parseTree(CborParser(BinStreamBuffer{file.data(), file.size()}), &arena);
+		auto t1 = getMicros();
+		std::cout << " - [tree] 'big.cbor' arena parse took: " << (t1-t0) * 1e-3 << "ms (" << arena.used() / (1<<20) << " MiB of nodes)\n";
+		EXPECT_TRUE(root.isVec() or root.isMap());
+	}
+
+	KeyInterner keys;
+	for (int i=0; i<2; i++) {
+		arena.reset();
+		auto t0 = getMicros();
+		Node root = parseTree(CborParser(BinStreamBuffer{file.data(), file.size()}), &arena, &keys);
+		auto t1 = getMicros();
+		std::cout << " - [tree] 'big.cbor' interned parse took: " << (t1-t0) * 1e-3 << "ms (" << keys.size() << " distinct keys)\n";
+		EXPECT_TRUE(root.isVec() or root.isMap());
+
+		if (i == 0) {
+			auto t2 = getMicros();
+			size_t size = encodedSize(root);
+			auto t3 = getMicros();
+			CborBufferEncoder encoder;
+			encodeTree(encoder, root);
+			size_t encoded = encoder.finish().size();
+			auto t4 = getMicros();
+			std::cout << " - [tree] 'big.cbor' sizing took: " << (t3-t2) * 1e-3 << "ms, encoding took: " << (t4-t3) * 1e-3 << "ms\n";
+			EXPECT_EQ(size, encoded);
+		}
+	}
+
+	for (int i=0; i<2; i++) {
+		std::vector<Arena> arenas;
+		auto t0 = getMicros();
+		Node root = parseTreeParallel(file.data(), file.size(), 0, &arenas);
+		auto t1 = getMicros();
+		std::cout << " - [tree] 'big.cbor' parallel parse took: " << (t1-t0) * 1e-3 << "ms (" << arenas.size() << " threads)\n";
+		EXPECT_TRUE(root.isVec() or root.isMap());
+	}
+}
@@ -2,6 +2,7 @@
 
 #include <fstream>
 #include <cassert>
+#include <variant>
 
 #include "cborCodec/cbor_parser.hpp"
 #include "cborCodec/cbor_encoder.hpp"
@@ -98,62 +99,58 @@ namespace {
 	template <class T>
 	inline bool isField(const Item& v, const T& t) {
 		// static_assert(std::is_integral_v<T>);
-		assert(std::holds_alternative<uint8_t>(v.value));
-		return std::get<uint8_t>(v.value) == static_cast<uint8_t>(t);
+		assert(v.is<uint8_t>());
+		return v.expect<uint8_t>() == static_cast<uint8_t>(t);
 	}
 
 	template <class T>
 	inline T convert(const Item& i) {
-		const auto& v = i.value;
-
 		// Allow implict int -> int conversions and int -> float conversions (but not float -> int)
 
 		if constexpr (std::is_same_v<T,int64_t>) {
-			if (std::holds_alternative<uint8_t>(v)) return std::get<uint8_t>(v);
-			if (std::holds_alternative<uint64_t>(v)) return std::get<uint64_t>(v);
-			// if (std::holds_alternative<int64_t>(v)) return std::get<int64_t>(v);
+			if (i.is<uint8_t>()) return i.expect<uint8_t>();
+			if (i.is<uint64_t>()) return i.expect<uint64_t>();
+			// if (i.is<int64_t>()) return i.expect<int64_t>();
 		}
 		else if constexpr (std::is_same_v<T,uint64_t>) {
-			if (std::holds_alternative<uint8_t>(v)) return std::get<uint8_t>(v);
-			// if (std::holds_alternative<uint64_t>(v)) return std::get<uint64_t>(v);
-			if (std::holds_alternative<int64_t>(v)) return std::get<int64_t>(v);
+			if (i.is<uint8_t>()) return i.expect<uint8_t>();
+			// if (i.is<uint64_t>()) return i.expect<uint64_t>();
+			if (i.is<int64_t>()) return i.expect<int64_t>();
 		}
 		else if constexpr (std::is_same_v<T,float>) {
-			if (std::holds_alternative<double>(v)) return std::get<double>(v);
-			if (std::holds_alternative<uint8_t>(v)) return std::get<uint8_t>(v);
-			if (std::holds_alternative<uint64_t>(v)) return std::get<uint64_t>(v);
-			if (std::holds_alternative<int64_t>(v)) return std::get<int64_t>(v);
+			if (i.is<double>()) return i.expect<double>();
+			if (i.is<uint8_t>()) return i.expect<uint8_t>();
+			if (i.is<uint64_t>()) return i.expect<uint64_t>();
+			if (i.is<int64_t>()) return i.expect<int64_t>();
 		}
 		else if constexpr (std::is_same_v<T,double>) {
-			if (std::holds_alternative<float>(v)) return std::get<float>(v);
-			if (std::holds_alternative<uint8_t>(v)) return std::get<uint8_t>(v);
-			if (std::holds_alternative<uint64_t>(v)) return std::get<uint64_t>(v);
-			if (std::holds_alternative<int64_t>(v)) return std::get<int64_t>(v);
+			if (i.is<float>()) return i.expect<float>();
+			if (i.is<uint8_t>()) return i.expect<uint8_t>();
+			if (i.is<uint64_t>()) return i.expect<uint64_t>();
+			if (i.is<int64_t>()) return i.expect<int64_t>();
 		}
 		
 		if constexpr (std::is_same_v<T,std::string>) {
-			assert(std::holds_alternative<TextBuffer>(v));
-			return std::string { std::get<TextBuffer>(v).asStringView() };
+			assert(i.is<TextBuffer>());
+			return std::string { i.expect<TextBuffer>().asStringView() };
 		}
 
 		else if constexpr (std::is_pointer_v<T>) {
 		}
 
 		else {
-			assert(std::holds_alternative<T>(v));
-			return std::get<T>(v);
+			assert(i.is<T>());
+			return i.expect<T>();
 		}
 	}
 
 	template <class T>
 	inline void convert1(const Item& i, T& t) {
-		const auto& v = i.value;
-
 		if constexpr (std::is_pointer_v<T> or std::is_array_v<T>) {
 
 			// NOTE: Only allow typed arrays -- not arrays with type tags every field.
-			assert(std::holds_alternative<TypedArrayBuffer>(v));
-			const auto &tav = std::get<TypedArrayBuffer>(v);
+			assert(i.is<TypedArrayBuffer>());
+			const auto tav = i.expect<TypedArrayBuffer>();
 
 			for (uint32_t i=0; i<tav.elementLength(); i++) {
 				if constexpr(std::is_pointer_v<T> && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<T>>,double>)
@@ -179,18 +176,18 @@ namespace {
 
 		// Allow implict int -> int conversions and int -> float conversions (but not float -> int)
 		else if constexpr (std::is_integral_v<T>) {
-			if (std::holds_alternative<uint8_t>(v)) t = std::get<uint8_t>(v);
-			else if (std::holds_alternative<uint64_t>(v)) t = std::get<uint64_t>(v);
-			else if (std::holds_alternative<int64_t>(v)) t = std::get<int64_t>(v);
+			if (i.is<uint8_t>()) t = i.expect<uint8_t>();
+			else if (i.is<uint64_t>()) t = i.expect<uint64_t>();
+			else if (i.is<int64_t>()) t = i.expect<int64_t>();
 			else assert(false);
 		}
 
 		else if constexpr (std::is_floating_point_v<T>) {
-			if (std::holds_alternative<float>(v)) t = std::get<float>(v);
-			else if (std::holds_alternative<double>(v)) t = std::get<double>(v);
-			else if (std::holds_alternative<uint8_t>(v)) t = std::get<uint8_t>(v);
-			else if (std::holds_alternative<uint64_t>(v)) t = std::get<uint64_t>(v);
-			else if (std::holds_alternative<int64_t>(v)) t = std::get<int64_t>(v);
+			if (i.is<float>()) t = i.expect<float>();
+			else if (i.is<double>()) t = i.expect<double>();
+			else if (i.is<uint8_t>()) t = i.expect<uint8_t>();
+			else if (i.is<uint64_t>()) t = i.expect<uint64_t>();
+			else if (i.is<int64_t>()) t = i.expect<int64_t>();
 			else assert(false);
 		}
 
@@ -200,14 +197,15 @@ namespace {
 
 
 
-	Message1 parseMessage1(CborParser& p, size_t numel) {
+	template <class Parser>
+	Message1 parseMessage1(Parser& p, size_t numel) {
 	// Message1 parseMessage1(CborParser& p) {
 		// auto bm = p.next();
-		// assert(std::holds_alternative<BeginMap>(bm.value));
-		// size_t numel = std::get<BeginMap>(bm.value).size;
+		// assert(bm.is<BeginMap>());
+		// size_t numel = bm.expect<BeginMap>().size;
 
 		Message1 m;
-		p.consumeMap(numel, [&m](Item&& k, Item&& v) {
+		p.consumeMap(numel, [&m](Item k, Item v) {
 			if (isField(k, Message1Tags::eField1)) m.field1 = convert<decltype(m.field1)>(v);
 			if (isField(k, Message1Tags::eField2)) m.field2 = convert<decltype(m.field2)>(v);
 			if (isField(k, Message1Tags::eField3)) m.field3 = convert<decltype(m.field3)>(v);
@@ -215,14 +213,15 @@ namespace {
 		});
 		return m;
 	}
-	Message2 parseMessage2(CborParser& p, size_t numel) {
+	template <class Parser>
+	Message2 parseMessage2(Parser& p, size_t numel) {
 	// Message2 parseMessage2(CborParser& p) {
 		// auto bm = p.next();
-		// assert(std::holds_alternative<BeginMap>(bm.value));
-		// size_t numel = std::get<BeginMap>(bm.value).size;
+		// assert(bm.is<BeginMap>());
+		// size_t numel = bm.expect<BeginMap>().size;
 
 		Message2 m;
-		p.consumeMap(numel, [&m](Item&& k, Item&& v) {
+		p.consumeMap(numel, [&m](Item k, Item v) {
 			if (isField(k, Message2Tags::eField0)) convert1(v, m.field0);
 			if (isField(k, Message2Tags::eField1)) convert1(v, m.field1);
 			if (isField(k, Message2Tags::eField2)) convert1(v, m.field2);
@@ -232,10 +231,11 @@ namespace {
 		return m;
 	}
 
+	template <class Parser>
 	struct Replay {
-		CborParser &p;
+		Parser &p;
 		std::vector<MessageVariant> msgs;
-		inline Replay(CborParser& p_) : p(p_) {
+		inline Replay(Parser& p_) : p(p_) {
 		}
 
 		inline void run() {
@@ -246,28 +246,28 @@ namespace {
 			// Similar to `visitArray`
 			int i = 0;
 			while (p.hasMore()) {
-				auto it = p.next();
-				assert(std::holds_alternative<BeginMap>(it.value));
-				visitRootItem(std::move(std::get<BeginMap>(it.value)));
+				Item it = p.next();
+				assert(it.is<BeginMap>());
+				visitRootItem(it.expect<BeginMap>());
 				i++;
 			}
 		}
 
 		inline void visitRootItem(BeginMap&& bm) {
-			auto k0 = p.next();
-			assert(std::holds_alternative<TextBuffer>(k0.value) and std::get<TextBuffer>(k0.value).asStringView() == "metadata");
-			auto meta = p.next();
-			assert(std::holds_alternative<BeginMap>(meta.value));
-			p.consumeMap(std::get<BeginMap>(meta.value).size, [](Item&& k, Item&& v) {});
-			// visitMetadata(std::move(std::get<BeginMap>(meta.value)));
-
-			auto k1 = p.next();
-			assert(std::holds_alternative<TextBuffer>(k1.value));
-			printf("%s\n", std::string{std::get<TextBuffer>(k1.value).asStringView()}.c_str());
-			assert(std::get<TextBuffer>(k1.value).asStringView() == "messages");
-			auto messages = p.next();
-			assert(std::holds_alternative<BeginMap>(messages.value));
-			visitMessages(std::move(std::get<BeginMap>(messages.value)));
+			Item k0 = p.next();
+			assert(k0.is<TextBuffer>() and k0.expect<TextBuffer>().asStringView() == "metadata");
+			Item meta = p.next();
+			assert(meta.is<BeginMap>());
+			p.skipRemaining(meta); // We don't need the metadata.
+			// visitMetadata(std::move(meta.expect<BeginMap>()));
+
+			Item k1 = p.next();
+			assert(k1.is<TextBuffer>());
+			printf("%s\n", std::string{k1.expect<TextBuffer>().asStringView()}.c_str());
+			assert(k1.expect<TextBuffer>().asStringView() == "messages");
+			Item messages = p.next();
+			assert(messages.is<BeginMap>());
+			visitMessages(messages.expect<BeginMap>());
 		}
 
 		inline void visitMetadata(BeginMap&& bm) {
@@ -275,13 +275,13 @@ namespace {
 
 		inline void visitMessages(BeginMap&& ba) {
 			int i = 0;
-			p.consumeMap(ba.size, [this,&i](Item&& k, Item&& v) {
+			p.consumeMap(ba.size, [this,&i](Item k, Item v) {
 
-					assert(std::holds_alternative<uint8_t>(k.value));
-					auto msgTag = (MessageTag) std::get<uint8_t>(k.value);
+					assert(k.is<uint8_t>());
+					auto msgTag = (MessageTag) k.expect<uint8_t>();
 
-					assert(std::holds_alternative<BeginMap>(v.value));
-					auto size =  std::get<BeginMap>(v.value).size;
+					assert(v.is<BeginMap>());
+					auto size =  v.expect<BeginMap>().size;
 
 					if (msgTag == MessageTag::eMessage1) {
 						Message1 m = parseMessage1(p, size);
@@ -384,7 +384,7 @@ TEST(BusMessageVisitor, One) {
 
 	// Now parsing directly from the file.
 	{
-		CborParser p(BinStreamFile{"/tmp/test.cbor"});
+		CborFileParser p(BinStreamFile{"/tmp/test.cbor"});
 		// std::cout << " - begin\n";
 		// JsonPrinter jp(p);
 		// std::cout << " - jp: " << jp.os << "\n";
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 
 #include <fstream>
+#include <fcntl.h>
 
 #include "cborCodec/cbor_encoder.hpp"
 #include "json_printer.hpp"
@@ -47,3 +48,378 @@ TEST(EncoderParser, TestCodeDecodeSimple) {
 	}
 
 }
+
+TEST(EncoderParser, IntegerWidths) {
+
+	std::vector<uint64_t> values {
+		0, 23, 24, 255, 256, 65535, 65536, (1lu << 32) - 1, 1lu << 32, std::numeric_limits<uint64_t>::max() };
+
+	CborEncoder encoder;
+	for (auto v : values) {
+		encoder.push_value(v);
+		encoder.push_value(-static_cast<int64_t>(v >> 1) - 1);
+	}
+	auto data = encoder.finish();
+
+	// Heads must be minimal: 1, 1, 2, 2, 3, 3, 5, 5, 9, 9 bytes for the unsigned values.
+	EXPECT_EQ(data[0], 0x00);
+	EXPECT_EQ(data[4], 0x18);
+	EXPECT_EQ(data[5], 24);
+
+	CborParser p(BinStreamBuffer{data.data(), data.size()});
+	for (auto v : values) {
+		EXPECT_EQ(p.next().asUInt().value(), v);
+		EXPECT_EQ(p.next().asInt().value(), -static_cast<int64_t>(v >> 1) - 1);
+	}
+	EXPECT_FALSE(p.hasMore());
+
+	std::vector<uint8_t> expected { 0x1b, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00 };
+	CborEncoder encoder2;
+	encoder2.push_value(uint64_t{1lu << 32});
+	EXPECT_EQ(encoder2.finish(), expected);
+}
+
+namespace {
+
+	// A hook that only knows the type-erased encoder.
+	struct Point {
+		int64_t x, y;
+		inline void encodeCbor(CborEncoder& ce) const {
+			ce.begin_array(2);
+			ce.push_value(x);
+			ce.push_value(y);
+		}
+	};
+
+	// A hook that is instantiated for each encoder.
+	struct Label {
+		std::string text;
+		template <class Encoder>
+		inline void encodeCbor(Encoder& ce) const {
+			ce.push_value(TextBuffer(text));
+		}
+	};
+
+	template <class Encoder>
+	inline void encodeSample(Encoder& encoder) {
+		encoder.begin_map(3);
+		encoder.push_key_value("point", Point{1, -2});
+		encoder.push_key_value("label", Label{"a label"});
+		encoder.push_value("values");
+		encoder.begin_array(3);
+			encoder.push_value(1.5f);
+			encoder.push_value(2.5);
+			encoder.push_value((const uint8_t*)"\x01\x02", 2);
+	}
+
+}
+
+TEST(EncoderParser, Sinks) {
+
+	CborEncoder erased;
+	encodeSample(erased);
+	std::vector<uint8_t> expected = erased.finish();
+
+	CborBufferEncoder buffer;
+	encodeSample(buffer);
+	EXPECT_EQ(buffer.finish(), expected);
+
+	{
+		CborFileEncoder file("/tmp/test_sinks.cbor");
+		encodeSample(file);
+		file.finish();
+	}
+	std::ifstream ifs("/tmp/test_sinks.cbor", std::ios::binary);
+	std::vector<uint8_t> written((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(written, expected);
+
+	CborParser p(BinStreamBuffer{expected.data(), expected.size()});
+	JsonPrinter jp(p);
+	EXPECT_EQ(jp.os, R"([{"point":[1,-2],"label":"a label","values":[1.500000,2.500000,<NO BYTE STRINGS IN JSON>]}])");
+
+	// The type-erased encoder can be moved, mid-message, out of a function or into a container.
+	auto make = [&]() {
+		CborEncoder e;
+		e.begin_map(3);
+		e.push_key_value("point", Point{1, -2});
+		return e;
+	};
+	std::vector<CborEncoder> encoders;
+	encoders.push_back(make());
+	encoders.emplace_back();
+	encoders.push_back(make());
+	CborEncoder& moved = encoders.back();
+	moved.push_key_value("label", Label{"a label"});
+	moved.push_value("values");
+	moved.begin_array(3);
+		moved.push_value(1.5f);
+		moved.push_value(2.5);
+		moved.push_value((const uint8_t*)"\x01\x02", 2);
+	EXPECT_EQ(moved.finish(), expected);
+
+	// One that forwards to another sink keeps forwarding to it.
+	CborBufferEncoder target;
+	CborEncoder forwarding(target.strm);
+	CborEncoder forwardingMoved(std::move(forwarding));
+	encodeSample(forwardingMoved);
+	EXPECT_EQ(target.finish(), expected);
+}
+
+TEST(EncoderParser, ReusedBuffers) {
+
+	// A reused buffer keeps its capacity (and memory) across messages.
+	CborGrowableEncoder growable(16);
+	encodeSample(growable);
+	ByteBuffer first = growable.finish();
+	std::vector<uint8_t> expected(first.buf, first.buf + first.len);
+	size_t capacity = growable.strm.capacity();
+	EXPECT_GE(capacity, expected.size());
+
+	for (int i=0; i<3; i++) {
+		growable.reset();
+		encodeSample(growable);
+		ByteBuffer again = growable.finish();
+		EXPECT_EQ(again.buf, first.buf);
+		EXPECT_EQ(std::vector<uint8_t>(again.buf, again.buf + again.len), expected);
+		EXPECT_EQ(growable.strm.capacity(), capacity);
+	}
+
+	ByteBuffer owned = growable.strm.release();
+	EXPECT_FALSE(owned.isView);
+	EXPECT_EQ(std::vector<uint8_t>(owned.buf, owned.buf + owned.len), expected);
+	encodeSample(growable);
+	EXPECT_EQ(growable.strm.size(), expected.size());
+
+	// A caller-provided buffer that fits.
+	std::vector<uint8_t> storage(expected.size());
+	CborSpanEncoder span(storage.data(), storage.size());
+	encodeSample(span);
+	EXPECT_FALSE(span.strm.overflowed());
+	EXPECT_EQ(span.finish(), expected.size());
+	EXPECT_EQ(storage, expected);
+
+	// One that does not: the needed size is still reported.
+	CborSpanEncoder small(storage.data(), storage.size() - 1);
+	encodeSample(small);
+	EXPECT_TRUE(small.strm.overflowed());
+	EXPECT_EQ(small.strm.size(), expected.size());
+	EXPECT_THROW(small.finish(), std::runtime_error);
+
+	// The plain buffer encoder hands out its bytes by move, and can go on encoding afterwards.
+	CborBufferEncoder buffer;
+	encodeSample(buffer);
+	EXPECT_EQ(buffer.finish(), expected);
+	encodeSample(buffer);
+	EXPECT_EQ(buffer.finish(), expected);
+}
+
+TEST(EncoderParser, Sizer) {
+
+	CborSizer sizer;
+	encodeSample(sizer);
+	size_t size = sizer.finish();
+
+	CborBufferEncoder buffer;
+	encodeSample(buffer);
+	EXPECT_EQ(buffer.finish().size(), size);
+
+	// Sized once, encoded straight into place.
+	std::vector<uint8_t> storage(size);
+	CborSpanEncoder span(storage.data(), storage.size());
+	encodeSample(span);
+	EXPECT_EQ(span.finish(), size);
+
+	// Strings, typed arrays and indefinite containers are counted like everything else.
+	std::vector<double> samples(1000, 1.0);
+	sizer.reset();
+	sizer.begin_array(kIndefiniteLength);
+	sizer.push_typed_array(samples.data(), samples.size());
+	sizer.push_value(std::string(300, 'x'));
+	sizer.end_indefinite();
+	EXPECT_EQ(sizer.finish(), size_t{1 + (2 + 3 + 8000) + (3 + 300) + 1});
+}
+
+namespace {
+
+	// Indefinite containers with nested definite and indefinite ones, and a count that needs a wider head.
+	template <class Encoder>
+	inline void encodeUnsized(Encoder& encoder) {
+		encoder.begin_map(kIndefiniteLength);
+			encoder.push_value("points");
+			encoder.begin_array(kIndefiniteLength);
+				for (int i=0; i<300; i++) {
+					encoder.begin_array(2);
+						encoder.push_value((int64_t)i);
+						encoder.begin_array(kIndefiniteLength);
+							encoder.push_value(Point{i, -i});
+						encoder.end_indefinite();
+				}
+			encoder.end_indefinite();
+			encoder.push_value("empty");
+			encoder.begin_map(kIndefiniteLength);
+			encoder.end_indefinite();
+			encoder.push_key_value("label", Label{"a label"});
+			encoder.push_value("samples");
+			float samples[3] = { 1, 2, 3 };
+			encoder.push_typed_array(samples, 3);
+		encoder.end_indefinite();
+	}
+
+}
+
+TEST(EncoderParser, PatchIndefinite) {
+
+	CborBufferEncoder plain;
+	encodeUnsized(plain);
+	std::vector<uint8_t> unpatched = plain.finish();
+
+	CborBufferEncoder encoder;
+	encoder.set_patch_indefinite();
+	encodeUnsized(encoder);
+	std::vector<uint8_t> patched = encoder.finish();
+
+	// Same document, but every container has a definite length.
+	auto json = [](std::vector<uint8_t>& data) {
+		CborParser p(BinStreamBuffer{data.data(), data.size()});
+		return JsonPrinter(p).os;
+	};
+	EXPECT_EQ(json(patched), json(unpatched));
+
+	CborParser p(BinStreamBuffer{patched.data(), patched.size()});
+	EXPECT_EQ(p.next().expect<BeginMap>().size, 4u);
+	p.next();
+	EXPECT_EQ(p.next().expect<BeginArray>().size, 300u);
+
+	// The sizer and the other buffer sinks agree.
+	CborSizer sizer;
+	sizer.set_patch_indefinite();
+	encodeUnsized(sizer);
+	EXPECT_EQ(sizer.finish(), patched.size());
+
+	CborGrowableEncoder growable(8);
+	growable.set_patch_indefinite();
+	encodeUnsized(growable);
+	ByteBuffer view = growable.finish();
+	EXPECT_EQ(std::vector<uint8_t>(view.buf, view.buf + view.len), patched);
+
+	std::vector<uint8_t> storage(patched.size());
+	CborSpanEncoder span(storage.data(), storage.size());
+	span.set_patch_indefinite();
+	encodeUnsized(span);
+	EXPECT_EQ(span.finish(), patched.size());
+	EXPECT_EQ(storage, patched);
+
+	CborSpanEncoder small(storage.data(), 100);
+	small.set_patch_indefinite();
+	encodeUnsized(small);
+	EXPECT_EQ(small.strm.size(), patched.size());
+	EXPECT_THROW(small.finish(), std::runtime_error);
+
+	// The type-erased encoder patches when its sink can: its own buffer, or a buffer it forwards to, but not a file.
+	CborEncoder erased;
+	erased.set_patch_indefinite();
+	encodeUnsized(erased);
+	EXPECT_EQ(erased.finish(), patched);
+
+	CborBufferEncoder target;
+	CborEncoder forwarding(target.strm);
+	forwarding.set_patch_indefinite();
+	encodeUnsized(forwarding);
+	EXPECT_EQ(target.finish(), patched);
+
+	CborEncoder file("/tmp/test_patch_indefinite.cbor");
+	EXPECT_THROW(file.set_patch_indefinite(), std::runtime_error);
+
+	// A container begun before patching was enabled still ends with a break byte.
+	CborBufferEncoder late;
+	late.begin_array(kIndefiniteLength);
+	late.set_patch_indefinite();
+		late.push_value((int64_t)1);
+		late.begin_array(kIndefiniteLength);
+			late.push_value((int64_t)2);
+		late.end_indefinite();
+	late.end_indefinite();
+	EXPECT_EQ(late.finish(), (std::vector<uint8_t>{ 0x9f, 0x01, 0x98, 0x01, 0x02, 0xff }));
+
+	// Hooks that take `CborEncoder&` are patched along with the encoder they are pushed into.
+	struct Unsized {
+		inline void encodeCbor(CborEncoder& ce) const {
+			ce.begin_array(kIndefiniteLength);
+				ce.push_value((int64_t)1);
+				ce.push_value((int64_t)2);
+			ce.end_indefinite();
+		}
+	};
+	CborBufferEncoder hooked;
+	hooked.set_patch_indefinite();
+	hooked.begin_array(kIndefiniteLength);
+		hooked.push_value(Unsized{});
+	hooked.end_indefinite();
+	EXPECT_EQ(hooked.finish(), (std::vector<uint8_t>{ 0x98, 0x01, 0x98, 0x02, 0x01, 0x02 }));
+
+	CborSizer hookedSize;
+	hookedSize.set_patch_indefinite();
+	hookedSize.push_value(Unsized{});
+	EXPECT_EQ(hookedSize.finish(), 4u);
+}
+
+TEST(EncoderParser, Scatter) {
+
+	std::vector<float> frame(1 << 18);
+	for (size_t i=0; i<frame.size(); i++) frame[i] = i * .25f;
+	std::vector<uint8_t> blob(100, 7);
+
+	auto encodeFrame = [&](auto& encoder) {
+		encoder.begin_map(3);
+			encoder.push_value("seq");
+			encoder.push_value((int64_t)42);
+			encoder.push_value("frame");
+			encoder.push_typed_array(frame.data(), frame.size());
+			encoder.push_value("small");
+			encoder.push_value(ByteBuffer(blob.data(), blob.size()));
+	};
+
+	CborBufferEncoder buffer;
+	encodeFrame(buffer);
+	std::vector<uint8_t> expected = buffer.finish();
+
+	CborScatterEncoder scatter;
+	encodeFrame(scatter);
+	EXPECT_EQ(scatter.strm.size(), expected.size());
+
+	// Only the frame is referenced: heads, the small blob and everything around them are copied.
+	const std::vector<iovec>& iov = scatter.finish();
+	ASSERT_EQ(iov.size(), 3u);
+	EXPECT_EQ(iov[1].iov_base, (void*)frame.data());
+	EXPECT_EQ(iov[1].iov_len, frame.size() * sizeof(float));
+
+	std::string path = "/tmp/test_scatter.cbor";
+	int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+	ASSERT_GE(fd, 0);
+	EXPECT_EQ(scatter.strm.writeTo(fd), expected.size());
+	EXPECT_EQ(scatter.strm.pwriteTo(fd, expected.size()), expected.size());
+	::close(fd);
+
+	std::ifstream ifs(path, std::ios::binary);
+	std::vector<uint8_t> written((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ASSERT_EQ(written.size(), 2 * expected.size());
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), written.begin()));
+	EXPECT_TRUE(std::equal(expected.begin(), expected.end(), written.begin() + expected.size()));
+
+	scatter.reset();
+	EXPECT_EQ(scatter.strm.size(), 0u);
+	EXPECT_TRUE(scatter.finish().empty());
+
+	// A hook that takes `CborEncoder&` still hands its payload over by reference.
+	struct Frame {
+		const std::vector<float>& samples;
+		inline void encodeCbor(CborEncoder& ce) const {
+			ce.push_typed_array(samples.data(), samples.size());
+		}
+	};
+	scatter.push_value(Frame{frame});
+	const std::vector<iovec>& hooked = scatter.finish();
+	ASSERT_GE(hooked.size(), 2u);
+	EXPECT_EQ(hooked[1].iov_base, (void*)frame.data());
+	EXPECT_EQ(hooked[1].iov_len, frame.size() * sizeof(float));
+}
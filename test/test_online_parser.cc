@@ -122,7 +122,7 @@ TEST(Parser, ConsumeMapButStop) {
 		CborParser p(BinStreamBuffer{data.data(), data.size()});
 
 		p.next();
-		p.consumeMap(2, [&](Item&& k, Item&& v) {
+		p.consumeMap(2, [&](Item k, Item v) {
 				nProcessedWithoutStop++;
 		});
 	}
@@ -130,7 +130,7 @@ TEST(Parser, ConsumeMapButStop) {
 		CborParser p(BinStreamBuffer{data.data(), data.size()});
 
 		p.next();
-		p.consumeMap(2, [&](Item&& k, Item&& v) {
+		p.consumeMap(2, [&](Item k, Item v) {
 				nProcessedWithStop++;
 				return false;
 		});
@@ -160,9 +160,9 @@ TEST(Parser, ConsumeInnerMap) {
 		CborParser p(BinStreamBuffer{data.data(), data.size()});
 		p.next();
 		int i = 0;
-		p.consumeMap(2, [&](Item&& k, Item&& v) {
+		p.consumeMap(2, [&](Item k, Item v) {
 			if (i == 1) {
-				p.consumeMap(1, [&](Item&& k, Item&& v) {
+				p.consumeMap(1, [&](Item k, Item v) {
 					printf("inner:: %s: %s\n", k.toString().c_str(), v.toString().c_str());
 				});
 			}
@@ -171,3 +171,252 @@ TEST(Parser, ConsumeInnerMap) {
 	}
 
 }
+
+TEST(Parser, BufferParserIsLean) {
+	// The buffer specialization must not carry any file stream state around (or anything else that needs freeing).
+	static_assert(std::is_trivially_destructible_v<CborParser>);
+	static_assert(std::is_same_v<CborParser::StreamType, BinStreamBuffer>);
+	static_assert(std::is_same_v<CborFileParser::StreamType, BinStreamFile>);
+}
+
+TEST(Parser, FileWindowsMatchBuffer) {
+
+	// Strings of many sizes so that some land inside a window, some straddle it and some exceed it.
+	CborEncoder encoder;
+	encoder.begin_array(200);
+	for (int i=0; i<200; i++) {
+		std::string key = "key" + std::to_string(i);
+		std::string val(i % 150, 'a' + (i % 26));
+		encoder.begin_map(2);
+		encoder.push_value(key);
+		encoder.push_value(val);
+		encoder.push_value("n");
+		encoder.push_value(int64_t{i * 1000});
+	}
+	auto data = encoder.finish();
+
+	std::string path = "/tmp/test_file_windows.cbor";
+	{
+		std::ofstream ofs(path, std::ios_base::binary);
+		ofs.write((const char*)data.data(), data.size());
+	}
+
+	CborParser bp(BinStreamBuffer{data.data(), data.size()});
+	JsonPrinter bjp(bp);
+
+	CborFileParser fp(BinStreamFile{path, BinStreamFile::kMinWindowSize});
+	JsonPrinter fjp(fp);
+
+	EXPECT_EQ(bjp.os, fjp.os);
+	unlink(path.c_str());
+}
+
+TEST(Parser, FilePosMatchesBuffer) {
+
+	// Strings that straddle the window end, or are far larger than a window, are partly read past it.
+	CborEncoder encoder;
+	encoder.begin_array(4);
+	encoder.push_value(std::string(100000, 'x'));
+	encoder.push_value(std::string(50, 'y'));
+	encoder.push_value(std::string(1000, 'z'));
+	encoder.push_value(int64_t{7});
+	auto data = encoder.finish();
+
+	std::string path = "/tmp/test_file_pos.cbor";
+	{
+		std::ofstream ofs(path, std::ios_base::binary);
+		ofs.write((const char*)data.data(), data.size());
+	}
+
+	CborParser bp(BinStreamBuffer{data.data(), data.size()});
+	CborFileParser fp(BinStreamFile{path, BinStreamFile::kMinWindowSize});
+	while (bp.hasMore()) {
+		bp.next();
+		fp.next();
+		EXPECT_EQ(fp.strm.pos(), bp.strm.pos());
+	}
+	EXPECT_EQ(fp.strm.pos(), data.size());
+	unlink(path.c_str());
+}
+
+TEST(Parser, NestingState) {
+
+	CborEncoder encoder;
+	encoder.begin_map(2);
+	encoder.push_value("a");
+	encoder.begin_array(kIndefiniteLength);
+	encoder.push_value(int64_t{1});
+	encoder.begin_array(0);
+	encoder.end_indefinite();
+	encoder.push_value("b");
+	encoder.push_value(int64_t{2});
+	encoder.push_value(int64_t{3});
+	auto data = encoder.finish();
+
+	CborParser p(BinStreamBuffer{data.data(), data.size()});
+	std::vector<size_t> depths;
+	while (p.hasMore()) {
+		p.next();
+		depths.push_back(p.depth());
+	}
+	//                                {  "a" [_  1  []  break "b" 2  3
+	EXPECT_EQ(depths, (std::vector<size_t>{1, 1, 2, 2, 2, 1, 1, 0, 0}));
+	EXPECT_EQ(p.state().sequenceIdx, 2u);
+
+	// Nesting deeper than the parser's inline stack is an error, not a crash.
+	std::vector<uint8_t> deep(CborParser::kMaxDepth + 1, 0b100'00001);
+	deep.push_back(0);
+	CborParser dp(BinStreamBuffer{deep.data(), deep.size()});
+	EXPECT_THROW({
+		while (dp.hasMore()) dp.next();
+	}, std::runtime_error);
+}
+
+TEST(Parser, SkipValue) {
+
+	CborEncoder encoder;
+	encoder.begin_array(3);
+	encoder.begin_map(2);
+		encoder.push_value("skipped");
+		encoder.begin_array(kIndefiniteLength);
+			encoder.push_value(std::string(300, 'x'));
+			double vs[4] = {1,2,3,4};
+			encoder.push_typed_array(vs, 4);
+			encoder.begin_map(kIndefiniteLength);
+			encoder.push_value("k");
+			encoder.push_value(Null{});
+			encoder.end_indefinite();
+		encoder.end_indefinite();
+		encoder.push_value("also skipped");
+		encoder.push_value(uint64_t{1} << 40);
+	encoder.begin_map(1);
+		encoder.push_value("partially read");
+		encoder.push_value(int64_t{-7});
+	encoder.push_value("last");
+	auto data = encoder.finish();
+
+	std::string path = "/tmp/test_skip_value.cbor";
+	{
+		std::ofstream ofs(path, std::ios_base::binary);
+		ofs.write((const char*)data.data(), data.size());
+	}
+
+	auto check = [](auto& p) {
+		EXPECT_TRUE(p.next().template is<BeginArray>());
+		p.skipValue();
+		EXPECT_EQ(p.depth(), 1u);
+
+		EXPECT_TRUE(p.next().template is<BeginMap>());
+		EXPECT_EQ(p.next().asStringView().value(), "partially read");
+		p.skipRemaining();
+		EXPECT_EQ(p.depth(), 1u);
+
+		EXPECT_EQ(p.next().asStringView().value(), "last");
+		EXPECT_EQ(p.depth(), 0u);
+		EXPECT_FALSE(p.hasMore());
+	};
+
+	CborParser bp(BinStreamBuffer{data.data(), data.size()});
+	check(bp);
+
+	CborFileParser fp(BinStreamFile{path, BinStreamFile::kMinWindowSize});
+	check(fp);
+
+	unlink(path.c_str());
+
+	// An empty container is closed as soon as it is returned: skipping it leaves its parent alone.
+	for (size_t size : { size_t(0), kIndefiniteLength }) {
+		CborEncoder encoder2;
+		encoder2.begin_map(2);
+			encoder2.push_value("meta");
+			encoder2.begin_map(size);
+			if (size == kIndefiniteLength) encoder2.end_indefinite();
+			encoder2.push_value("messages");
+			encoder2.push_value(int64_t{5});
+		auto data2 = encoder2.finish();
+
+		CborParser p(BinStreamBuffer{data2.data(), data2.size()});
+		p.next();
+		EXPECT_EQ(p.next().asStringView().value(), "meta");
+		p.skipRemaining(p.next());
+		EXPECT_EQ(p.depth(), 1u);
+		EXPECT_EQ(p.next().asStringView().value(), "messages");
+		EXPECT_EQ(p.next().asInt().value(), 5);
+		EXPECT_FALSE(p.hasMore());
+	}
+}
+
+TEST(Parser, TryNext) {
+
+	CborEncoder encoder;
+	encoder.begin_map(2);
+		encoder.push_value("text");
+		encoder.push_value(std::string(40, 'x'));
+		encoder.push_value("tav");
+		float vs[4] = {1,2,3,4};
+		encoder.push_typed_array(vs, 4);
+	auto data = encoder.finish();
+
+	auto drain = [](const uint8_t* ptr, size_t len) {
+		CborParser p(BinStreamBuffer{ptr, len});
+		Item it;
+		while (p.hasMore()) {
+			DecodeStatus status = p.tryNext(it);
+			if (!status) return status;
+		}
+		return p.tryNext(it);
+	};
+
+	EXPECT_TRUE(drain(data.data(), data.size()).ok());
+
+	// Every strict prefix is truncated somewhere, and is reported as such instead of reading past the end.
+	for (size_t len = 1; len < data.size(); len++) {
+		std::vector<uint8_t> prefix(data.begin(), data.begin() + len);
+		DecodeStatus status = drain(prefix.data(), prefix.size());
+		EXPECT_EQ(status.error, DecodeError::Truncated) << "prefix of " << len << " bytes";
+		EXPECT_LE(status.offset, len);
+	}
+
+	// A bogus length must not wrap around the bounds check.
+	std::vector<uint8_t> huge { 0b011'11011, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 };
+	EXPECT_EQ(drain(huge.data(), huge.size()).error, DecodeError::Truncated);
+
+	// The offset is the start of the offending item.
+	std::vector<uint8_t> stray { 0b100'00001, 0b000'00001, 0b111'11111 };
+	DecodeStatus status = drain(stray.data(), stray.size());
+	EXPECT_EQ(status.error, DecodeError::UnexpectedBreak);
+	EXPECT_EQ(status.offset, 2u);
+
+	std::vector<uint8_t> tagged { 0b110'00001, 0b000'00001 };
+	EXPECT_EQ(drain(tagged.data(), tagged.size()).error, DecodeError::UnsupportedTag);
+
+	std::vector<uint8_t> deep(CborParser::kMaxDepth + 1, 0b100'00001);
+	deep.push_back(0);
+	status = drain(deep.data(), deep.size());
+	EXPECT_EQ(status.error, DecodeError::NestingTooDeep);
+	EXPECT_EQ(status.offset, CborParser::kMaxDepth);
+
+	// The throwing API reports the same.
+	CborParser p(BinStreamBuffer{stray.data(), stray.size()});
+	p.next();
+	p.next();
+	EXPECT_THROW(p.next(), std::runtime_error);
+
+	CborParser sp(BinStreamBuffer{data.data(), data.size() - 1});
+	EXPECT_EQ(sp.trySkipValue().error, DecodeError::Truncated);
+
+	// Skipping, too, reports input that ends inside a container.
+	std::vector<uint8_t> open { 0b100'00010, 0b000'00001 };
+	CborParser op(BinStreamBuffer{open.data(), open.size()});
+	op.next();
+	EXPECT_TRUE(op.trySkipValue().ok());
+	status = op.trySkipValue();
+	EXPECT_EQ(status.error, DecodeError::Truncated);
+	EXPECT_EQ(status.offset, 2u);
+
+	// Skipping and reading agree on which typed arrays are supported: not float16 ones.
+	std::vector<uint8_t> half { 0b110'11000, 0b010'10000, 0b010'00010, 0, 0 };
+	EXPECT_EQ(drain(half.data(), half.size()).error, DecodeError::UnsupportedFloat);
+	CborParser hp(BinStreamBuffer{half.data(), half.size()});
+	EXPECT_EQ(hp.trySkipValue().error, DecodeError::UnsupportedFloat);
+}
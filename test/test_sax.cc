@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <array>
+
+#include "cborCodec/cbor_sax.hpp"
+#include "cborCodec/cbor_encoder.hpp"
+
+using namespace cbor;
+
+namespace {
+
+	// Writes a compact, JSON-like trace of every event.
+	struct Tracer : SaxHandler<Tracer> {
+		std::string out;
+
+		void on_uint(uint64_t v) { out += std::to_string(v) + " "; }
+		void on_int(int64_t v) { out += std::to_string(v) + " "; }
+		void on_double(double v) { out += "d" + std::to_string((int)v) + " "; }
+		void on_bool(bool v) { out += v ? "true " : "false "; }
+		void on_null() { out += "null "; }
+		void on_text(std::string_view v) { out += "\"" + std::string(v) + "\" "; }
+		void on_typed_array(TypedArrayBuffer::Type type, bool, const byte*, size_t len) { out += "ta" + std::to_string(type) + ":" + std::to_string(len) + " "; }
+		void on_begin_map(size_t size) { out += size == kIndefiniteLength ? "{_ " : "{ "; }
+		void on_end_map() { out += "} "; }
+		void on_begin_array(size_t size) { out += size == kIndefiniteLength ? "[_ " : "[ "; }
+		void on_end_array() { out += "] "; }
+	};
+
+	std::vector<uint8_t> makeDoc() {
+		CborEncoder encoder;
+		encoder.begin_map(3);
+			encoder.push_value("a");
+			encoder.begin_array(kIndefiniteLength);
+				encoder.push_value(int64_t{-5});
+				encoder.push_value(uint64_t{300});
+				encoder.push_value(True{});
+				encoder.begin_map(0);
+			encoder.end_indefinite();
+
+			encoder.push_value("b");
+			encoder.push_value(Null{});
+
+			encoder.push_value("c");
+			encoder.begin_array(2);
+				encoder.push_value(2.0);
+				std::array<float,3> fs { 1, 2, 3 };
+				encoder.push_value(TypedArrayBuffer{fs});
+		return encoder.finish();
+	}
+
+}
+
+TEST(Sax, Events) {
+	auto data = makeDoc();
+
+	Tracer h;
+	EXPECT_TRUE(h.parse(data.data(), data.size()));
+	EXPECT_EQ(h.out, "{ \"a\" [_ -5 300 true { } ] \"b\" null \"c\" [ d2 ta" + std::to_string(TypedArrayBuffer::eFloat32) + ":12 ] } ");
+}
+
+TEST(Sax, DefaultCallbacks) {
+	auto data = makeDoc();
+
+	// Only texts are of interest; everything else falls through to the defaults.
+	struct Texts : SaxHandler<Texts> {
+		std::vector<std::string> texts;
+		void on_text(std::string_view v) { texts.emplace_back(v); }
+	} h;
+	h.parse(data.data(), data.size());
+	EXPECT_EQ(h.texts, (std::vector<std::string>{"a", "b", "c"}));
+}
+
+TEST(Sax, SkipAndStop) {
+	auto data = makeDoc();
+
+	// Returning false from a begin callback skips the container.
+	struct SkipArrays : SaxHandler<SkipArrays> {
+		std::string out;
+		void on_text(std::string_view v) { out += std::string(v) + " "; }
+		void on_null() { out += "null "; }
+		bool on_begin_array(size_t) { out += "[...] "; return false; }
+		void on_end_array() { out += "] "; }
+	} skip;
+	EXPECT_TRUE(skip.parse(data.data(), data.size()));
+	EXPECT_EQ(skip.out, "a [...] b null c [...] ");
+
+	// Returning false from any other callback stops.
+	struct StopAtNull : SaxHandler<StopAtNull> {
+		int texts = 0;
+		void on_text(std::string_view) { texts++; }
+		bool on_null() { return false; }
+	} stop;
+	EXPECT_FALSE(stop.parse(data.data(), data.size()));
+	EXPECT_EQ(stop.texts, 2);
+}
+
+TEST(Sax, Malformed) {
+	struct Nothing : SaxHandler<Nothing> {} h;
+
+	std::vector<uint8_t> unterminated { 0b100'11111, 0b000'00001 };
+	EXPECT_THROW(h.parse(unterminated.data(), unterminated.size()), std::runtime_error);
+
+	std::vector<uint8_t> strayBreak { 0b100'00001, 0b000'00001, 0b111'11111 };
+	EXPECT_THROW(h.parse(strayBreak.data(), strayBreak.size()), std::runtime_error);
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include "cborCodec/cbor_tape.hpp"
+#include "cborCodec/cbor_encoder.hpp"
+
+using namespace cbor;
+
+TEST(Tape, Simple) {
+
+	CborEncoder encoder;
+	encoder.begin_map(3);
+
+	encoder.push_value("key1");
+	encoder.begin_array(kIndefiniteLength);
+		encoder.push_value(int64_t{1});
+		encoder.begin_map(kIndefiniteLength);
+			encoder.push_value("inner");
+			encoder.push_value(Null{});
+		encoder.end_indefinite();
+		encoder.push_value(std::string(100, 'x'));
+	encoder.end_indefinite();
+
+	encoder.push_value("key2");
+	encoder.begin_array(0);
+
+	encoder.push_value("key3");
+	encoder.push_value(2.5);
+
+	auto data = encoder.finish();
+	Tape tape = buildTape(data.data(), data.size());
+
+	//  0 {  1 "key1"  2 [_  3 1  4 {_  5 "inner"  6 null  7 "xx.."  8 "key2"  9 []  10 "key3"  11 2.5
+	ASSERT_EQ(tape.size(), 12u);
+	EXPECT_EQ(tape[0].itemType(), ItemType::BeginMap);
+	EXPECT_EQ(tape[0].count, 3u);
+	EXPECT_EQ(tape[0].next, 12u);
+
+	// Indefinite containers have their sizes counted.
+	EXPECT_EQ(tape[2].count, 3u);
+	EXPECT_EQ(tape[2].next, 8u);
+	EXPECT_EQ(tape.item(2).expect<BeginArray>().size, 3u);
+	EXPECT_EQ(tape[4].count, 1u);
+	EXPECT_EQ(tape[4].next, 7u);
+
+	EXPECT_EQ(tape[9].count, 0u);
+	EXPECT_EQ(tape[9].next, 10u);
+
+	// Walk the root map's values by jumping over siblings.
+	std::vector<size_t> values;
+	for (size_t i = tape.firstChild(0); i < tape[0].next; i = tape.nextSibling(tape.nextSibling(i))) {
+		values.push_back(tape.nextSibling(i));
+	}
+	EXPECT_EQ(values, (std::vector<size_t>{2, 9, 11}));
+
+	EXPECT_EQ(tape.item(1).asStringView().value(), "key1");
+	EXPECT_EQ(tape.item(7).asStringView().value(), std::string(100, 'x'));
+	EXPECT_EQ(tape.item(11).asDouble().value(), 2.5);
+
+	// Typed arrays the parser does not support (here float16) are rejected while building, not when read.
+	std::vector<uint8_t> half { 0b110'11000, 0b010'10000, 0b010'00010, 0, 0 };
+	EXPECT_THROW(buildTape(half.data(), half.size()), std::runtime_error);
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "cborCodec/cbor_tree_parser.hpp"
+#include "cborCodec/cbor_parallel.hpp"
 #include "cborCodec/cbor_encoder.hpp"
 
 #include "json_printer.hpp"
@@ -34,21 +35,21 @@ using namespace cbor;
 				s = "(bool)";
 				break;
 			case Kind::Text:
-				s = std::string{e.text.asStringView()};
+				s = std::string{e.asStringView()};
 				break;
 			case Kind::Bytes:
-				s = "(bytes " + std::to_string(e.bytes.len) + ")";
+				s = "(bytes " + std::to_string(e.len) + ")";
 				break;
 			case Kind::Vec:
 				s = "[\n";
-				for (auto& v : e.vec) {
+				for (auto& v : e.items()) {
 					s += toString(v, depth + 1);
 				}
 				s += "\n" + pre + "]\n";
 				break;
 			case Kind::Map: {
 				s = "{\n";
-				for (auto& kv : e.map) {
+				for (auto& kv : e.pairs()) {
 					s += toString(kv.first, depth + 1);
 					s += " -> ";
 					s += toString(kv.second, depth + 1);
@@ -137,6 +138,479 @@ TEST(TreeParser, Bytes) {
 
 }
 
+TEST(TreeParser, CompactNodes) {
+
+	CborEncoder encoder;
+	encoder.begin_map(3);
+		encoder.push_value("list");
+		encoder.begin_array(kIndefiniteLength);
+			encoder.push_value(int64_t{-1});
+			encoder.push_value(Null{});
+			encoder.push_value(std::string(100, 'y'));
+		encoder.end_indefinite();
+		encoder.push_value("map");
+		encoder.begin_map(kIndefiniteLength);
+			encoder.push_value("k");
+			encoder.push_value(1.5);
+		encoder.end_indefinite();
+		encoder.push_value("tav");
+		double vs[3] = {1,2,3};
+		encoder.push_typed_array(vs, 3);
+	auto data = encoder.finish();
+
+	auto check = [&](const Node& e, bool views) {
+		ASSERT_TRUE(e.isMap());
+		EXPECT_EQ(e.size(), 3u);
+		EXPECT_EQ(e["list"].size(), 3u);
+		EXPECT_EQ(e["list"][0].asInt(), -1);
+		EXPECT_TRUE(e["list"][1].isNull());
+		EXPECT_EQ(e["list"][2].asStringView(), std::string(100, 'y'));
+		EXPECT_EQ(e["map"]["k"].asFloat64(), 1.5);
+		EXPECT_EQ(e["tav"].asTypedArray().toVector<double>(), (std::vector<double>{1,2,3}));
+		EXPECT_FALSE(e.has("missing"));
+
+		// Strings point into the input buffer unless the stream could not keep them alive.
+		const byte* text = e["list"][2].ptr;
+		EXPECT_EQ(text >= data.data() and text < data.data() + data.size(), views);
+		EXPECT_EQ(e["list"][2].owned, !views);
+	};
+
+	CborParser bp(BinStreamBuffer{data.data(), data.size()});
+	Node e = parseTree(bp);
+	check(e, true);
+
+	std::string path = "/tmp/test_compact_nodes.cbor";
+	{
+		std::ofstream ofs(path, std::ios_base::binary);
+		ofs.write((const char*)data.data(), data.size());
+	}
+	Node f = parseTree(CborFileParser(BinStreamFile{path, BinStreamFile::kMinWindowSize}));
+	check(f, false);
+	unlink(path.c_str());
+
+	// Moving hands over the children.
+	Node g = std::move(e);
+	EXPECT_TRUE(e.isInvalid());
+	check(g, true);
+
+	// Round trip.
+	CborEncoder encoder2;
+	encodeTree(encoder2, g);
+	EXPECT_EQ(encoder2.finish().size(), data.size() - 2); // Indefinite containers are re-encoded with definite lengths.
+}
+
+TEST(TreeParser, Arena) {
+
+	CborEncoder encoder;
+	encoder.begin_array(kIndefiniteLength);
+	for (int i=0; i<100; i++) {
+		encoder.begin_map(2);
+			encoder.push_value("id");
+			encoder.push_value(int64_t{i});
+			encoder.push_value("name");
+			encoder.push_value("item " + std::to_string(i));
+	}
+	encoder.end_indefinite();
+	auto data = encoder.finish();
+
+	std::string path = "/tmp/test_arena.cbor";
+	{
+		std::ofstream ofs(path, std::ios_base::binary);
+		ofs.write((const char*)data.data(), data.size());
+	}
+
+	Arena arena(256);
+	size_t capacity = 0;
+	for (int round=0; round<3; round++) {
+		arena.reset();
+
+		// File input copies strings, into the arena here.
+		Node e = parseTree(CborFileParser(BinStreamFile{path, BinStreamFile::kMinWindowSize}), &arena);
+		ASSERT_EQ(e.size(), 100u);
+		EXPECT_EQ(e[42]["id"].asInt(), 42);
+		EXPECT_EQ(e[42]["name"].asStringView(), "item 42");
+		EXPECT_FALSE(e.owned);
+		EXPECT_FALSE(e[42]["name"].owned);
+
+		// Re-parsing after a reset reuses the chunks.
+		if (round == 0) capacity = arena.capacity();
+		EXPECT_EQ(arena.capacity(), capacity);
+		EXPECT_GT(arena.used(), 100 * 2 * sizeof(KeyValue));
+	}
+	unlink(path.c_str());
+}
+
+TEST(TreeParser, KeyIndex) {
+
+	CborEncoder encoder;
+	encoder.begin_map(303);
+	for (int i=299; i>=0; i--) {
+		encoder.push_value("key" + std::to_string(i));
+		encoder.push_value(int64_t{i});
+	}
+	// Integer keys, as in the integer-tagged bus messages.
+	encoder.push_value(int64_t{-3});
+	encoder.push_value("minus three");
+	encoder.push_value(uint64_t{1} << 40);
+	encoder.push_value("big");
+	encoder.push_value(uint64_t{7});
+	encoder.begin_map(1);
+		encoder.push_value(uint64_t{0});
+		encoder.push_value("nested");
+	auto data = encoder.finish();
+
+	CborParser p(BinStreamBuffer{data.data(), data.size()});
+	Node e = parseTree(p);
+
+	auto check = [](const Node& e) {
+		for (int i=0; i<300; i++) EXPECT_EQ(e["key" + std::to_string(i)].asInt(), i);
+		EXPECT_FALSE(e.has("key300"));
+		EXPECT_FALSE(e.has(int64_t{8}));
+		EXPECT_EQ(e.find(int64_t{-3})->second.asStringView(), "minus three");
+		EXPECT_EQ(e.find(int64_t{1} << 40)->second.asStringView(), "big");
+		EXPECT_EQ(e[7][0].asStringView(), "nested");
+		EXPECT_THROW(e[8], std::runtime_error);
+	};
+
+	// Linear scans first, then binary searches.
+	check(e);
+	EXPECT_FALSE(e.sorted);
+	e.buildIndex(true);
+	EXPECT_TRUE(e.sorted);
+	EXPECT_TRUE(e[7].sorted);
+	check(e);
+
+	// Integers sort before text.
+	EXPECT_EQ(e.pairs()[0].first.asInt(), -3);
+	EXPECT_EQ(e.pairs()[1].first.asInt(), 7);
+	EXPECT_EQ(e.pairs()[3].first.asStringView(), "key0");
+}
+
+TEST(TreeParser, DeepNesting) {
+
+	// As deep as the parser allows, alternating definite arrays and indefinite maps.
+	const size_t depth = CborParser::kMaxDepth;
+	CborEncoder encoder;
+	for (size_t i=0; i<depth; i++) {
+		if (i % 2 == 0) {
+			encoder.begin_array(2);
+			encoder.push_value(uint64_t{i});
+		} else {
+			encoder.begin_map(kIndefiniteLength);
+			encoder.push_value("k");
+		}
+	}
+	encoder.push_value("leaf");
+	for (size_t i=depth; i-- > 0; ) {
+		if (i % 2 == 1) encoder.end_indefinite();
+	}
+	auto data = encoder.finish();
+
+	CborParser p(BinStreamBuffer{data.data(), data.size()});
+	Node root = parseTree(p);
+
+	const Node* n = &root;
+	for (size_t i=0; i<depth; i++) {
+		if (i % 2 == 0) {
+			ASSERT_TRUE(n->isVec());
+			EXPECT_EQ((*n)[0].asUint(), i);
+			n = &(*n)[1];
+		} else {
+			ASSERT_TRUE(n->isMap());
+			ASSERT_EQ(n->size(), 1u);
+			n = &(*n)["k"];
+		}
+	}
+	EXPECT_EQ(n->asStringView(), "leaf");
+
+	// Encoding does not recurse either: a tree far deeper than any parser stack.
+	Node deep = Node::fromText("bottom");
+	for (int i=0; i<2000; i++) {
+		std::vector<Node> v;
+		v.push_back(std::move(deep));
+		deep = Node::fromVec(std::move(v));
+	}
+	CborEncoder encoder2;
+	encodeTree(encoder2, deep);
+	auto data2 = encoder2.finish();
+	EXPECT_EQ(data2.size(), size_t{2000 + 7});
+	EXPECT_EQ(data2.front(), 0b100'00001);
+	EXPECT_EQ(data2[2000], 0b011'00110);
+}
+
+TEST(TreeParser, Document) {
+
+	auto makeMessage = [](int seq) {
+		CborEncoder encoder;
+		encoder.begin_map(3);
+			encoder.push_value("seq");
+			encoder.push_value(int64_t{seq});
+			encoder.push_value("tags");
+			encoder.begin_array(kIndefiniteLength);
+			for (int i=0; i<seq % 5; i++) encoder.push_value("tag" + std::to_string(i));
+			encoder.end_indefinite();
+			encoder.push_value("body");
+			encoder.push_value(std::string(50 + seq % 7, 'b'));
+		return encoder.finish();
+	};
+
+	Document doc;
+	size_t capacity = 0;
+	for (int seq=0; seq<100; seq++) {
+		auto data = makeMessage(seq);
+
+		// File input, so that the strings are copied into the document too.
+		std::string path = "/tmp/test_document.cbor";
+		{
+			std::ofstream ofs(path, std::ios_base::binary);
+			ofs.write((const char*)data.data(), data.size());
+		}
+		const Node& root = doc.parse(CborFileParser(BinStreamFile{path}));
+		unlink(path.c_str());
+
+		ASSERT_TRUE(root.isMap());
+		EXPECT_EQ(root["seq"].asInt(), seq);
+		EXPECT_EQ(root["tags"].size(), size_t(seq % 5));
+		EXPECT_EQ(root["body"].asStringView().size(), size_t(50 + seq % 7));
+
+		// Warmed up after one of each message shape: no more chunks.
+		if (seq == 35) capacity = doc.arena().capacity();
+		if (seq > 35) {
+			EXPECT_EQ(doc.arena().capacity(), capacity);
+		}
+	}
+
+	doc.reset();
+	EXPECT_TRUE(doc.root().isInvalid());
+}
+
+TEST(TreeParser, SharedInput) {
+
+	std::vector<float> samples(1000);
+	for (size_t i=0; i<samples.size(); i++) samples[i] = i * .5f;
+
+	CborEncoder encoder;
+	encoder.begin_map(2);
+		encoder.push_value("name");
+		encoder.push_value("telemetry");
+		encoder.push_value("channels");
+		encoder.begin_array(1);
+			encoder.begin_map(1);
+				encoder.push_value("samples");
+				encoder.push_typed_array(samples.data(), samples.size());
+	std::vector<uint8_t> data = encoder.finish();
+
+	auto stream = BinStreamShared::fromVector(std::move(data));
+	std::weak_ptr<const byte> slab = stream.slab();
+	const byte* begin = stream.slab().get();
+	const byte* end = begin + stream.len;
+
+	SharedNode tree = parseShared(CborSharedParser(std::move(stream)));
+	SharedNode channel = share(tree, (*tree)["channels"][0]);
+	TypedArrayBuffer tab = sharedTypedArray(share(tree, (*channel)["samples"]));
+
+	// No copies: the typed array is a view into the slab.
+	EXPECT_TRUE(tab.buf > begin and tab.buf < end);
+	EXPECT_TRUE(tab.isView);
+
+	// The slab lives as long as anything refers to it.
+	tree.reset();
+	EXPECT_FALSE(slab.expired());
+	channel.reset();
+	EXPECT_FALSE(slab.expired());
+	EXPECT_EQ(tab.toVector<float>(), samples);
+
+	tab = TypedArrayBuffer{};
+	EXPECT_TRUE(slab.expired());
+}
+
+TEST(TreeParser, InternedKeys) {
+
+	auto encode = [](int64_t id, const char* name) {
+		CborEncoder encoder;
+		encoder.begin_map(2);
+			encoder.push_value("id");
+			encoder.push_value(id);
+			encoder.push_value("name");
+			encoder.push_value(name);
+		return encoder.finish();
+	};
+	std::vector<uint8_t> a = encode(1, "first");
+	std::vector<uint8_t> b = encode(2, "second");
+
+	KeyInterner keys;
+	Node ta = parseTree(CborParser(BinStreamBuffer{a.data(), a.size()}), nullptr, &keys);
+	Node tb = parseTree(CborParser(BinStreamBuffer{b.data(), b.size()}), nullptr, &keys);
+	EXPECT_EQ(keys.size(), 2u);
+
+	// Both documents share the canonical key bytes, and ids resolve by integer compare.
+	KeyId id = keys.lookup("id");
+	EXPECT_NE(id.id, KeyInterner::kNoKey);
+	EXPECT_EQ(ta.find(id)->first.asStringView().data(), tb.find(id)->first.asStringView().data());
+	EXPECT_EQ(ta[id].asInt(), 1);
+	EXPECT_EQ(tb[keys.lookup("name")].asStringView(), "second");
+	EXPECT_EQ(keys.name(id), "id");
+
+	// Values are not interned, and string lookups still work.
+	EXPECT_EQ(ta["name"].keyId, 0u);
+	EXPECT_EQ(tb["id"].asInt(), 2);
+	EXPECT_EQ(ta.find(keys.lookup("missing")), nullptr);
+
+	// Past the cap, new keys stay plain text, and earlier ones are still interned.
+	KeyInterner capped(1);
+	Node tc = parseTree(CborParser(BinStreamBuffer{a.data(), a.size()}), nullptr, &capped);
+	EXPECT_EQ(capped.size(), 1u);
+	EXPECT_EQ(tc.kvs[0].first.keyId, capped.lookup("id").id);
+	EXPECT_EQ(tc.kvs[1].first.keyId, 0u);
+	EXPECT_EQ(capped.lookup("name").id, KeyInterner::kNoKey);
+	EXPECT_EQ(tc["name"].asStringView(), "first");
+	EXPECT_EQ(tc[capped.lookup("id")].asInt(), 1);
+}
+
+TEST(TreeParser, Projection) {
+
+	CborEncoder encoder;
+	encoder.begin_map(4);
+		encoder.push_value("header");
+		encoder.begin_map(2);
+			encoder.push_value("id");
+			encoder.push_value((int64_t)7);
+			encoder.push_value("time");
+			encoder.push_value(1.5);
+		encoder.push_value((int64_t)3);
+		encoder.push_value("integer key");
+		encoder.push_value("points");
+		encoder.begin_array(2);
+			for (int i=0; i<2; i++) {
+				encoder.begin_map(kIndefiniteLength);
+					encoder.push_value("x");
+					encoder.push_value((int64_t)i);
+					encoder.push_value("y");
+					encoder.begin_array(1);
+						encoder.push_value((int64_t)i);
+				encoder.end_indefinite();
+			}
+		encoder.push_value("meta");
+		encoder.begin_map(1);
+			encoder.push_value("ignored");
+			encoder.push_value(Null{});
+	std::vector<uint8_t> data = encoder.finish();
+
+	Projection fields({ "header.id", "points.y" });
+	Node root = parseTree(CborParser(BinStreamBuffer{data.data(), data.size()}), fields);
+
+	ASSERT_EQ(root.size(), 2u);
+	EXPECT_EQ(root["header"].size(), 1u);
+	EXPECT_EQ(root["header"]["id"].asInt(), 7);
+	EXPECT_FALSE(root.has("meta"));
+	EXPECT_EQ(root.find(3), nullptr);
+
+	// Arrays pass the projection on to their elements, and path ends are kept whole.
+	ASSERT_EQ(root["points"].size(), 2u);
+	EXPECT_FALSE(root["points"][1].has("x"));
+	EXPECT_EQ(root["points"][1]["y"][0].asInt(), 1);
+
+	// A path that is a prefix of another keeps everything below it.
+	Projection whole({ "header", "header.id" });
+	Node header = parseTree(CborParser(BinStreamBuffer{data.data(), data.size()}), whole);
+	EXPECT_EQ(header["header"].size(), 2u);
+	EXPECT_EQ(header.size(), 1u);
+
+	// The same result without a projection.
+	Node full = parseTree(CborParser(BinStreamBuffer{data.data(), data.size()}));
+	EXPECT_EQ(full.size(), 4u);
+	EXPECT_EQ(full["points"][0].size(), 2u);
+
+	// Keys that are empty containers are skipped along with their value, and the rest of the map is still read.
+	CborEncoder odd;
+	odd.begin_map(2);
+		odd.push_value("a");
+		odd.begin_map(3);
+			odd.begin_array(0);
+			odd.push_value((int64_t)1);
+			odd.begin_map(kIndefiniteLength);
+			odd.end_indefinite();
+			odd.push_value((int64_t)2);
+			odd.push_value("keep");
+			odd.push_value((int64_t)3);
+		odd.push_value("b");
+		odd.push_value((int64_t)9);
+	std::vector<uint8_t> oddData = odd.finish();
+	Node kept = parseTree(CborParser(BinStreamBuffer{oddData.data(), oddData.size()}), Projection({ "a.keep", "b" }));
+	ASSERT_EQ(kept["a"].size(), 1u);
+	EXPECT_EQ(kept["a"]["keep"].asInt(), 3);
+	EXPECT_EQ(kept["b"].asInt(), 9);
+
+	// Empty input gives an empty node, with or without a projection.
+	EXPECT_EQ(parseTree(CborParser(BinStreamBuffer{data.data(), 0})).kind, Kind::Invalid);
+	EXPECT_EQ(parseTree(CborParser(BinStreamBuffer{data.data(), 0}), fields).kind, Kind::Invalid);
+}
+
+TEST(TreeParser, Parallel) {
+
+	auto reencode = [](const Node& n) {
+		CborEncoder encoder;
+		encodeTree(encoder, n);
+		return encoder.finish();
+	};
+
+	for (size_t size : { kIndefiniteLength, size_t(1000) }) {
+		CborEncoder encoder;
+		encoder.begin_array(size);
+			for (int i=0; i<1000; i++) {
+				encoder.begin_map(2);
+					encoder.push_value("id");
+					encoder.push_value((int64_t)i);
+					encoder.push_value("tags");
+					encoder.begin_array(i % 4);
+						for (int j=0; j<i%4; j++) encoder.push_value("tag");
+			}
+		if (size == kIndefiniteLength) encoder.end_indefinite();
+		std::vector<uint8_t> data = encoder.finish();
+
+		Node serial = parseTree(CborParser(BinStreamBuffer{data.data(), data.size()}));
+		for (size_t threads : { 1, 3, 8 }) {
+			std::vector<Arena> arenas;
+			Node parallel = parseTreeParallel(data.data(), data.size(), threads, &arenas);
+			EXPECT_EQ(arenas.size(), threads);
+			ASSERT_EQ(parallel.size(), 1000u);
+			EXPECT_EQ(parallel[999]["id"].asInt(), 999);
+			EXPECT_EQ(reencode(parallel), reencode(serial));
+			EXPECT_EQ(encodedSize(parallel), reencode(serial).size());
+		}
+	}
+
+	// Maps are split by pairs; scalars are parsed serially.
+	CborEncoder encoder;
+	encoder.begin_map(100);
+		for (int i=0; i<100; i++) {
+			encoder.push_value((int64_t)i);
+			encoder.push_value((int64_t)-i);
+		}
+	std::vector<uint8_t> data = encoder.finish();
+	Node map = parseTreeParallel(data.data(), data.size(), 4);
+	EXPECT_EQ(map[size_t(42)].asInt(), -42);
+
+	std::vector<uint8_t> scalar = { 0x18, 0x2a };
+	EXPECT_EQ(parseTreeParallel(scalar.data(), scalar.size()).asInt(), 42);
+
+	// Errors on worker threads reach the caller. A half float passes the boundary scan, which only reads heads, but
+	// fails when the last quarter of the children is parsed.
+	CborEncoder values;
+	values.begin_array(100);
+		for (int i=0; i<100; i++) values.push_value((int64_t)1000);
+	std::vector<uint8_t> bad = values.finish();
+	size_t at = 2 + 90 * 3;
+	ASSERT_EQ(bad[at], 0x19);
+	bad[at] = 0xf9; bad[at + 1] = 0x3c; bad[at + 2] = 0x00;
+	try {
+		parseTreeParallel(bad.data(), bad.size(), 4);
+		ADD_FAILURE() << "expected an error";
+	} catch (const std::runtime_error& e) {
+		EXPECT_NE(std::string(e.what()).find("half float"), std::string::npos) << e.what();
+	}
+}
+
 /*
 TEST(TreeParser, ConsumeInnerMap) {
 
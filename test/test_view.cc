@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include "cborCodec/cbor_view.hpp"
+#include "cborCodec/cbor_encoder.hpp"
+
+using namespace cbor;
+
+namespace {
+	std::vector<uint8_t> makeMessage() {
+		CborEncoder encoder;
+		encoder.begin_map(4);
+			encoder.push_value("header");
+			encoder.begin_map(2);
+				encoder.push_value("id");
+				encoder.push_value(int64_t{1234});
+				encoder.push_value("stamp");
+				encoder.push_value(1.25);
+
+			// Something large to skip over.
+			encoder.push_value("payload");
+			encoder.begin_array(kIndefiniteLength);
+			for (int i=0; i<50; i++) {
+				encoder.begin_map(1);
+				encoder.push_value("blob");
+				encoder.push_value(std::string(100, 'a' + (i % 26)));
+			}
+			encoder.end_indefinite();
+
+			encoder.push_value("names");
+			encoder.begin_array(3);
+				encoder.push_value("zero");
+				encoder.push_value("one");
+				encoder.push_value("two");
+
+			// Integer keys.
+			encoder.push_value(uint64_t{7});
+			encoder.begin_map(kIndefiniteLength);
+				encoder.push_value(uint64_t{1});
+				encoder.push_value(True{});
+				encoder.push_value(int64_t{-1});
+				encoder.push_value(Null{});
+			encoder.end_indefinite();
+		return encoder.finish();
+	}
+}
+
+TEST(View, Lookup) {
+	auto data = makeMessage();
+	CborView root(data.data(), data.size());
+
+	ASSERT_TRUE(root.isMap());
+	EXPECT_EQ(root.size(), 4u);
+	EXPECT_EQ(root.encodedSize(), data.size());
+
+	EXPECT_EQ(root["header"]["id"].as<int64_t>(), 1234);
+	EXPECT_EQ(root["header"]["stamp"].as<double>(), 1.25);
+	EXPECT_EQ(root["names"][2].as<std::string_view>(), "two");
+	EXPECT_EQ(root["payload"].size(), 50u);
+	EXPECT_EQ(root["payload"][49]["blob"].as<std::string_view>(), std::string(100, 'a' + 49 % 26));
+	EXPECT_TRUE(root[7][1].as<bool>());
+	EXPECT_EQ(root[7].size(), 2u);
+
+	// Views point into the buffer.
+	auto text = root["names"][0].as<std::string_view>();
+	EXPECT_TRUE((const uint8_t*)text.data() > data.data() and (const uint8_t*)text.data() < data.data() + data.size());
+
+	// Missing things give invalid views, which chain.
+	EXPECT_FALSE(root["missing"]);
+	EXPECT_FALSE(root["missing"]["deeper"][3]);
+	EXPECT_FALSE(root["names"][3]);
+	EXPECT_FALSE(root[8]);
+	EXPECT_THROW(root["missing"].as<int64_t>(), std::runtime_error);
+	EXPECT_THROW(root["names"].as<int64_t>(), std::runtime_error);
+
+	// Integers only convert when they fit.
+	CborEncoder encoder;
+	encoder.begin_array(2);
+	encoder.push_value(std::numeric_limits<uint64_t>::max());
+	encoder.push_value(int64_t{-5});
+	auto ints = encoder.finish();
+	CborView arr(ints.data(), ints.size());
+	EXPECT_EQ(arr[0].as<uint64_t>(), std::numeric_limits<uint64_t>::max());
+	EXPECT_THROW(arr[0].as<int64_t>(), std::runtime_error);
+	EXPECT_EQ(arr[1].as<int64_t>(), -5);
+	EXPECT_THROW(arr[1].as<uint64_t>(), std::runtime_error);
+}
+
+TEST(View, Iteration) {
+	auto data = makeMessage();
+	CborView root(data.data(), data.size());
+
+	std::vector<std::string> keys;
+	for (auto e : root.entries()) {
+		if (e.key.type() == ItemType::Text) keys.emplace_back(e.key.as<std::string_view>());
+	}
+	EXPECT_EQ(keys, (std::vector<std::string>{"header", "payload", "names"}));
+
+	std::vector<std::string> names;
+	for (auto v : root["names"].elements()) names.emplace_back(v.as<std::string_view>());
+	EXPECT_EQ(names, (std::vector<std::string>{"zero", "one", "two"}));
+
+	// Indefinite-length containers end at their break byte.
+	size_t n = 0;
+	for (auto v : root["payload"].elements()) {
+		EXPECT_TRUE(v.isMap());
+		n++;
+	}
+	EXPECT_EQ(n, 50u);
+
+	size_t pairs = 0;
+	for (auto e : root[7].entries()) pairs++;
+	EXPECT_EQ(pairs, 2u);
+}